@@ -0,0 +1,134 @@
+// Copyright 2018 Erik Corry.  See the LICENSE file, the BSD 2-clause
+// license.
+
+// AVX2 versions of the fastest routines in search2.cc.  They are the same
+// algorithms with 256 bit loads and 32 bit masks.  They are compiled for AVX2
+// one function at a time, so the rest of the program still runs on CPUs
+// without it, but they must only be called if the CPU has AVX2.
+
+#include <stdint.h>
+
+#include "search.h"
+
+// Search for "*" using only aligned AVX2 256 bit loads. This may load data
+// either side of the string, but can never cause a fault because the loads are
+// in 256 bit sections also covered by the string.
+__attribute__((target("avx2")))
+int test_pure_avx2(const char* s, int len) {
+  int last_bits = (uintptr_t)s & 31;
+  uint32_t alignment_mask = 0xffffffffu << last_bits;
+  const uint256_t mask = _mm256_set1_epi8('*');
+  for (int i = -last_bits ; i < len; i += 32) {
+    // Load aligned to a 256 bit YMM register.
+    uint256_t raw = *(uint256_t*)(s + i);
+    // VPCMPEQB and VPMOVMSKB, as in test_pure_sse2, but 32 bytes at a time.
+    uint32_t bits = _mm256_movemask_epi8(_mm256_cmpeq_epi8(raw, mask)) & alignment_mask;
+    if (bits) {
+      int answer = i + __builtin_ctz(bits);
+      if (answer >= len) return -127;
+      return answer;
+    }
+    alignment_mask = 0xffffffffu;
+  }
+  return -127;
+}
+
+// Search for "*#" using only aligned AVX2 256 bit loads. This may load data
+// either side of the string, but can never cause a fault because the loads are
+// in 256 bit sections also covered by the string.  The stars are shifted up by
+// one before being compared with the hashes, so the star at the end of one
+// block is carried into bit 0 for the next block.  That needs 33 bits, so the
+// stars are kept in a 64 bit integer.
+__attribute__((target("avx2")))
+int test_pure_twobavx2(const char* s, int len) {
+  int last_bits = (uintptr_t)s & 31;
+  uint32_t alignment_mask = 0xffffffffu << last_bits;
+  const uint256_t star_pattern = _mm256_set1_epi8('*');
+  const uint256_t hash_pattern = _mm256_set1_epi8('#');
+  uint64_t stars = 0;
+  for (int i = -last_bits ; i < len; i += 32) {
+    uint256_t raw = *(uint256_t*)(s + i);
+    uint32_t new_stars = _mm256_movemask_epi8(_mm256_cmpeq_epi8(raw, star_pattern));
+    stars += (uint64_t)(new_stars & alignment_mask) << 1;
+    uint32_t hashes = _mm256_movemask_epi8(_mm256_cmpeq_epi8(raw, hash_pattern));
+    // We need to find out if the nth bit of hashes is set and also
+    // the n-1th bit of stars.
+    uint32_t combined = hashes & (uint32_t)stars;
+    if (combined) {
+      int result = i + __builtin_ctz(combined) - 1;
+      if (result >= len - 1) return -127;
+      return result;
+    }
+    stars >>= 32;
+    alignment_mask = 0xffffffffu;
+  }
+  return -127;
+}
+
+// Search for "*" with one unaligned load of the first 32 bytes, like
+// test_small_sse2.
+__attribute__((target("avx2")))
+int test_small_avx2(const char* s, int len) {
+  if (len <= 0) return -127;
+  if (((uintptr_t)s & 4095) > 4096 - 32) return test_pure_avx2(s, len);
+  const uint256_t mask = _mm256_set1_epi8('*');
+  uint256_t raw = _mm256_loadu_si256((const uint256_t*)s);
+  uint32_t bits = _mm256_movemask_epi8(_mm256_cmpeq_epi8(raw, mask));
+  if (len < 32) bits &= (1u << len) - 1;
+  if (bits) return __builtin_ctz(bits);
+  for (int i = ((uintptr_t)(s + 32) & ~(uintptr_t)31) - (uintptr_t)s; i < len; i += 32) {
+    raw = *(uint256_t*)(s + i);
+    bits = _mm256_movemask_epi8(_mm256_cmpeq_epi8(raw, mask));
+    if (bits) {
+      int answer = i + __builtin_ctz(bits);
+      if (answer >= len) return -127;
+      return answer;
+    }
+  }
+  return -127;
+}
+
+// Search for "__" (double underscore) using only aligned AVX2 256 bit loads.
+// See search_for_double_underscore and test_pure_twobavx2.
+__attribute__((target("avx2")))
+int search_for_double_underscore_avx2(const char* s, int len) {
+  int last_bits = (uintptr_t)s & 31;
+  uint32_t alignment_mask = 0xffffffffu << last_bits;
+  const uint256_t underscore_pattern = _mm256_set1_epi8('_');
+  uint64_t first_char = 0;
+  for (int i = -last_bits ; i < len; i += 32) {
+    uint256_t raw = *(uint256_t*)(s + i);
+    uint32_t second_char = _mm256_movemask_epi8(_mm256_cmpeq_epi8(raw, underscore_pattern));
+    first_char += (uint64_t)(second_char & alignment_mask) << 1;
+    uint32_t combined = (uint32_t)first_char & second_char;
+    if (combined) {
+      int result = i + __builtin_ctz(combined) - 1;
+      if (result >= len - 1) return -127;
+      return result;
+    }
+    first_char >>= 32;
+    alignment_mask = 0xffffffffu;
+  }
+  return -127;
+}
+
+// inline_pure_avx2, out of line.
+__attribute__((target("avx2")))
+int search_pure_avx2(const Needle& n, const char* s, int len) {
+  return inline_pure_avx2(n, s, len);
+}
+
+// inline_pure_twobavx2, out of line.
+__attribute__((target("avx2")))
+int search_pure_twobavx2(const Needle2& n, const char* s, int len) {
+  return inline_pure_twobavx2(n, s, len);
+}
+
+// For the harness.
+static KernelInfo kernels[] = {
+  {"pure_avx2", test_pure_avx2, 1, ISA_AVX2, ALIGNED},
+  {"pure_twobavx2", test_pure_twobavx2, 2, ISA_AVX2, ALIGNED},
+  {"small_avx2", test_small_avx2, 1, ISA_AVX2, PAGE},
+  {"pure_avx2", ByteSearch<search_pure_avx2>(), ISA_AVX2, ALIGNED},
+  {"pure_twobavx2", PairSearch<search_pure_twobavx2>(), ISA_AVX2, ALIGNED},
+};
@@ -0,0 +1,229 @@
+// Copyright 2018 Erik Corry.  See the LICENSE file, the BSD 2-clause
+// license.
+
+// Templates that generate the search routines for any needle that is known at
+// compile time, as a JIT would, instead of just for '*' and "*#".  The
+// patterns are constants, so there is no setup per call.  Include search.h
+// rather than this file.
+
+#ifndef CONSTANT_H_
+#define CONSTANT_H_
+
+#include "search.h"
+
+// The needle byte repeated across a word.
+template<char C>
+struct Broadcast {
+  static constexpr uint32_t mask32 = (uint8_t)C * 0x01010101ul;
+  static constexpr uint64_t mask64 = (uint8_t)C * 0x0101010101010101ul;
+};
+
+// See test_pure_sse2.
+template<char C>
+int constant_pure_sse2(const char* s, int len) {
+  int last_bits = (uintptr_t)s & 15;
+  int alignment_mask = 0xffff << last_bits;
+  const uint128_t mask = _mm_set1_epi8(C);
+  for (int i = -last_bits ; i < len; i += 16) {
+    uint128_t raw = *(uint128_t*)(s + i);
+    int bits = _mm_movemask_epi8(_mm_cmpeq_epi8(raw, mask)) & alignment_mask;
+    if (bits) {
+      int answer = i + __builtin_ffs(bits) - 1;
+      if (answer >= len) return -127;
+      return answer;
+    }
+    alignment_mask = 0xffff;
+  }
+  return -127;
+}
+
+// See test_sse2.
+template<char C>
+int constant_sse2(const char* s, int len) {
+  int i = 0;
+  while (i < len) {
+    if (s[i] == C) {
+      return i;
+    }
+    i++;
+    if (((uintptr_t)(s + i) & 15) == 0) break;
+  }
+  if (i >= len) return -127;
+  const uint128_t mask = _mm_set1_epi8(C);
+  for ( ; i < len; i += 16) {
+    uint128_t raw = *(uint128_t*)(s + i);
+    int bits = _mm_movemask_epi8(_mm_cmpeq_epi8(raw, mask));
+    if (bits) {
+      int answer = i + __builtin_ffs(bits) - 1;
+      if (answer >= len) return -127;
+      return answer;
+    }
+  }
+  return -127;
+}
+
+// See test_mycroft.
+template<char C>
+int constant_mycroft(const char* s, int len) {
+  int i = 0;
+  while (i < len) {
+    if (s[i] == C) {
+      return i;
+    }
+    i++;
+    if (((uintptr_t)(s + i) & 7) == 0) break;
+  }
+  if (i >= len) return -127;
+  const uint64_t mask = Broadcast<C>::mask64;
+  const uint64_t highs = 0x8080808080808080ul;
+  const uint64_t ones = 0x0101010101010101ul;
+  for ( ; i < len; i += 8) {
+    uint64_t raw = *(uint64_t*)(s + i) ^ mask;
+    raw = (raw - ones) & (~raw) & highs;
+    if (raw) {
+      int answer = i + (__builtin_ffsll(raw) >> 3) - 1;
+      if (answer >= len) return -127;
+      return answer;
+    }
+  }
+  return -127;
+}
+
+// See test_pure_mycroft.
+template<char C>
+int constant_pure_mycroft(const char* s, int len) {
+  int last_bits = (uintptr_t)s & 7;
+  int i = -last_bits;
+  const uint64_t mask = Broadcast<C>::mask64;
+  uint64_t before = ~(~(uint64_t)0 << (last_bits << 3));
+  const uint64_t highs = 0x8080808080808080ul;
+  const uint64_t ones = 0x0101010101010101ul;
+  for ( ; i < len; i += 8) {
+    uint64_t raw = (*(uint64_t*)(s + i) ^ mask) | before;
+    raw = (raw - ones) & (~raw) & highs;
+    if (raw) {
+      int answer = i + (__builtin_ffsll(raw) >> 3) - 1;
+      if (answer >= len) return -127;
+      return answer;
+    }
+    before = 0;
+  }
+  return -127;
+}
+
+// See test_pure_twobsse2.
+template<char C1, char C2>
+int constant_pure_twobsse2(const char* s, int len) {
+  int last_bits = (uintptr_t)s & 15;
+  int alignment_mask = 0xffff << last_bits;
+  const uint128_t star_pattern = _mm_set1_epi8(C1);
+  const uint128_t hash_pattern = _mm_set1_epi8(C2);
+  int stars = 0;
+  for (int i = -last_bits ; i < len; i += 16) {
+    uint128_t raw = *(uint128_t*)(s + i);
+    stars += (_mm_movemask_epi8(_mm_cmpeq_epi8(raw, star_pattern)) & alignment_mask) << 1;
+    int hashes = _mm_movemask_epi8(_mm_cmpeq_epi8(raw, hash_pattern));
+    int combined = hashes & stars;
+    if (combined) {
+      int result = i + __builtin_ffs(combined) - 2;
+      if (result >= len - 1) return -127;
+      return result;
+    }
+    stars >>= 16;
+    alignment_mask = 0xffff;
+  }
+  return -127;
+}
+
+// See test_twosse2.
+template<char C1, char C2>
+int constant_twosse2(const char* s, int len) {
+  int i = 0;
+  while (i < len - 1) {
+    if (s[i] == C1 && s[i + 1] == C2) {
+      return i;
+    }
+    i++;
+    if (((uintptr_t)(s + i) & 15) == 0) break;
+  }
+  if (i >= len - 1) return -127;
+  const uint128_t star_pattern = _mm_set1_epi8(C1);
+  const uint128_t hash_pattern = _mm_set1_epi8(C2);
+  int prev = (s[i - 1] == C1) << 15;
+  for ( ; i < len; i += 16) {
+    uint128_t raw = *(uint128_t*)(s + i);
+    int stars = _mm_movemask_epi8(_mm_cmpeq_epi8(raw, star_pattern));
+    int hashes = _mm_movemask_epi8(_mm_cmpeq_epi8(raw, hash_pattern));
+    if ((prev & 0x8000) && (hashes & 1)) return i - 1;
+    int combined = (stars << 1) & hashes;
+    if (combined) {
+      int result = i + __builtin_ffs(combined) - 2;
+      if (result >= len - 1) return -127;
+      return result;
+    }
+    prev = stars;
+  }
+  return -127;
+}
+
+// See test_mycroft2.
+template<char C1, char C2>
+int constant_mycroft2(const char* s, int len) {
+  int i = 0;
+  while (i < len - 1) {
+    if (s[i] == C1 && s[i + 1] == C2) {
+      return i;
+    }
+    i++;
+    if (((uintptr_t)(s + i) & 7) == 0) break;
+  }
+  if (i >= len - 1) return -127;
+  const uint64_t mask_star = Broadcast<C1>::mask64;
+  const uint64_t mask_hash = Broadcast<C2>::mask64;
+  const uint64_t highs = 0x8080808080808080ul;
+  const uint64_t lows = 0x7f7f7f7f7f7f7f7ful;
+  for ( ; i < len; i += 8) {
+    uint64_t raw = *(uint64_t*)(s + i - 1) ^ mask_star;
+    uint64_t raw2 = *(uint64_t*)(s + i) ^ mask_hash;
+    raw = ~(((raw & lows) + lows) | raw);
+    raw2 = ~(((raw2 & lows) + lows) | raw2);
+    uint64_t combined = raw & raw2 & highs;
+    if (combined) {
+      int result = (i - 1) + (__builtin_ffsll(combined) >> 3) - 1;
+      if (result >= len - 1) return -127;
+      return result;
+    }
+  }
+  return -127;
+}
+
+// See test_pure_mycroft2.
+template<char C1, char C2>
+int constant_pure_mycroft2(const char* s, int len) {
+  int last_bits = (uintptr_t)s & 7;
+  int i = -last_bits;
+  const uint64_t mask_star = Broadcast<C1>::mask64;
+  const uint64_t mask_hash = Broadcast<C2>::mask64;
+  uint64_t highs = 0x8080808080808080ul << (last_bits << 3);
+  const uint64_t lows = 0x7f7f7f7f7f7f7f7ful;
+  uint64_t stars_low = 0;
+  for ( ; i < len; i += 8) {
+    uint64_t raw = *(uint64_t*)(s + i);
+    uint64_t new_stars = raw ^ mask_star;
+    uint64_t hashes = raw ^ mask_hash;
+    new_stars = ~(((new_stars & lows) + lows) | new_stars) & highs;
+    hashes = ~(((hashes & lows) + lows) | hashes);
+    stars_low += new_stars << 8;
+    uint64_t combined = stars_low & hashes;
+    if (combined) {
+      int result = (i - 1) + (__builtin_ffsll(combined) >> 3) - 1;
+      if (result >= len - 1) return -127;
+      return result;
+    }
+    stars_low = new_stars >> 56;
+    highs = 0x8080808080808080ul;
+  }
+  return -127;
+}
+
+#endif  // CONSTANT_H_
@@ -0,0 +1,50 @@
+// Copyright 2018 Erik Corry.  See the LICENSE file, the BSD 2-clause
+// license.
+
+// Entry points that use the fastest search routine the CPU can run.  The
+// choice is made once, by the dynamic linker, using GNU indirect functions.
+// After that a call to search_byte costs the same as a call to any other
+// function in a shared library: an indirect jump through the GOT, with no
+// test of the CPU features.
+
+#include "search.h"
+
+typedef int byte_searcher(const Needle& n, const char* s, int len);
+typedef int pair_searcher(const Needle2& n, const char* s, int len);
+
+// The resolvers run while the program is being relocated, before any
+// constructors, so they have to initialize the CPU feature tests themselves.
+// They are extern "C" because the ifunc attribute names them unmangled.
+// They also run before AddressSanitizer has mapped its shadow memory, so
+// their reads of the CPU features must not be checked.
+extern "C" {
+
+__attribute__((no_sanitize_address))
+static byte_searcher* resolve_search_byte() {
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) return search_pure_avx2;
+  if (__builtin_cpu_supports("sse2")) return search_pure_sse2;
+  return search_pure_mycroft;
+}
+
+__attribute__((no_sanitize_address))
+static pair_searcher* resolve_search_pair() {
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) return search_pure_twobavx2;
+  if (__builtin_cpu_supports("sse2")) return search_pure_twobsse2;
+  return search_pure_mycroft2;
+}
+
+}
+
+int search_byte(const Needle& n, const char* s, int len)
+    __attribute__((ifunc("resolve_search_byte")));
+
+int search_pair(const Needle2& n, const char* s, int len)
+    __attribute__((ifunc("resolve_search_pair")));
+
+// For the harness.  All the routines they pick read in aligned blocks.
+static KernelInfo kernels[] = {
+  {"search_byte", ByteSearch<search_byte>(), ISA_SSE2, ALIGNED},
+  {"search_pair", PairSearch<search_pair>(), ISA_SSE2, ALIGNED},
+};
@@ -0,0 +1,162 @@
+// Copyright 2018 Erik Corry.  See the LICENSE file, the BSD 2-clause
+// license.
+
+// Kernels that never read a byte outside the string, so they can be run
+// under AddressSanitizer and valgrind.  The SSE2 and AVX2 versions load
+// whole blocks from inside the string, and search the last block by loading
+// it from the end, overlapping the one before, in which there was no match.
+// Strings shorter than a block are loaded in two overlapping halves, or a
+// byte at a time if they are shorter than 4 bytes.  The AVX-512 versions
+// use loads with a mask of the bytes in the string, which don't touch the
+// memory for the other bytes.
+
+#include <stdint.h>
+#include <string.h>
+
+#include "search.h"
+
+// The bits for the bytes of a string of 0 to 15 bytes that are c.  8 or
+// more bytes are loaded as the first 8 and the last 8, which are put in one
+// register and compared together.  The bits for the last 8 are shifted to
+// their positions in the string, where they may overlap the first 8.
+static inline int short_bits(const char* s, int len, char c) {
+  const uint128_t pattern = _mm_set1_epi8(c);
+  if (len >= 8) {
+    uint128_t first = _mm_loadl_epi64((const uint128_t*)s);
+    uint128_t last = _mm_loadl_epi64((const uint128_t*)(s + len - 8));
+    int bits = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_unpacklo_epi64(first, last), pattern));
+    return (bits & 0xff) | (bits >> 8) << (len - 8);
+  }
+  if (len >= 4) {
+    int32_t first, last;
+    memcpy(&first, s, 4);
+    memcpy(&last, s + len - 4, 4);
+    uint128_t both = _mm_unpacklo_epi32(_mm_cvtsi32_si128(first), _mm_cvtsi32_si128(last));
+    int bits = _mm_movemask_epi8(_mm_cmpeq_epi8(both, pattern));
+    return (bits & 0xf) | ((bits >> 4) & 0xf) << (len - 4);
+  }
+  int bits = 0;
+  for (int i = 0; i < len; i++) {
+    if (s[i] == c) bits |= 1 << i;
+  }
+  return bits;
+}
+
+// Search for "*" with unaligned SSE2 loads that are all inside the string.
+int test_exact_sse2(const char* s, int len) {
+  if (len < 16) {
+    int bits = short_bits(s, len, '*');
+    return bits ? __builtin_ctz(bits) : -127;
+  }
+  const uint128_t mask = _mm_set1_epi8('*');
+  for (int i = 0; i < len - 16; i += 16) {
+    uint128_t raw = _mm_loadu_si128((const uint128_t*)(s + i));
+    int bits = _mm_movemask_epi8(_mm_cmpeq_epi8(raw, mask));
+    if (bits) return i + __builtin_ctz(bits);
+  }
+  // The last 16 bytes.
+  uint128_t raw = _mm_loadu_si128((const uint128_t*)(s + len - 16));
+  int bits = _mm_movemask_epi8(_mm_cmpeq_epi8(raw, mask));
+  return bits ? len - 16 + __builtin_ctz(bits) : -127;
+}
+
+// Search for "*#" by comparing the bytes from s + i with '*' and the bytes
+// from s + i + 1 with '#', like test_padded_twobsse2.  A match at the last
+// position has its hash at len - 1, so the last load of stars is at
+// len - 17.
+int test_exact_twobsse2(const char* s, int len) {
+  if (len < 17) {
+    if (len < 2) return -127;
+    int combined = short_bits(s, len - 1, '*') & short_bits(s + 1, len - 1, '#');
+    return combined ? __builtin_ctz(combined) : -127;
+  }
+  const uint128_t star_pattern = _mm_set1_epi8('*');
+  const uint128_t hash_pattern = _mm_set1_epi8('#');
+  for (int i = 0; ; i += 16) {
+    // The last 16 positions, if there are no more whole blocks.
+    if (i > len - 17) i = len - 17;
+    uint128_t stars = _mm_cmpeq_epi8(_mm_loadu_si128((const uint128_t*)(s + i)), star_pattern);
+    uint128_t hashes = _mm_cmpeq_epi8(_mm_loadu_si128((const uint128_t*)(s + i + 1)), hash_pattern);
+    int combined = _mm_movemask_epi8(_mm_and_si128(stars, hashes));
+    if (combined) return i + __builtin_ctz(combined);
+    if (i == len - 17) return -127;
+  }
+}
+
+// test_exact_sse2 with 32 byte loads.  Shorter strings use the SSE2
+// version.
+__attribute__((target("avx2")))
+int test_exact_avx2(const char* s, int len) {
+  if (len < 32) return test_exact_sse2(s, len);
+  const uint256_t mask = _mm256_set1_epi8('*');
+  for (int i = 0; i < len - 32; i += 32) {
+    uint256_t raw = _mm256_loadu_si256((const uint256_t*)(s + i));
+    uint32_t bits = _mm256_movemask_epi8(_mm256_cmpeq_epi8(raw, mask));
+    if (bits) return i + __builtin_ctz(bits);
+  }
+  uint256_t raw = _mm256_loadu_si256((const uint256_t*)(s + len - 32));
+  uint32_t bits = _mm256_movemask_epi8(_mm256_cmpeq_epi8(raw, mask));
+  return bits ? len - 32 + __builtin_ctz(bits) : -127;
+}
+
+// test_exact_twobsse2 with 32 byte loads.
+__attribute__((target("avx2")))
+int test_exact_twobavx2(const char* s, int len) {
+  if (len < 33) return test_exact_twobsse2(s, len);
+  const uint256_t star_pattern = _mm256_set1_epi8('*');
+  const uint256_t hash_pattern = _mm256_set1_epi8('#');
+  for (int i = 0; ; i += 32) {
+    if (i > len - 33) i = len - 33;
+    uint256_t stars = _mm256_cmpeq_epi8(_mm256_loadu_si256((const uint256_t*)(s + i)), star_pattern);
+    uint256_t hashes = _mm256_cmpeq_epi8(_mm256_loadu_si256((const uint256_t*)(s + i + 1)), hash_pattern);
+    uint32_t combined = _mm256_movemask_epi8(_mm256_and_si256(stars, hashes));
+    if (combined) return i + __builtin_ctz(combined);
+    if (i == len - 33) return -127;
+  }
+}
+
+// Search for "*" 64 bytes at a time, with a masked load for the bytes left
+// after the last whole block.  VMOVDQU8 with a zeroing mask doesn't read the
+// bytes that are masked off, so it can't fault on them.
+__attribute__((target("avx512bw")))
+int test_exact_avx512(const char* s, int len) {
+  const uint512_t mask = _mm512_set1_epi8('*');
+  int i = 0;
+  for ( ; i <= len - 64; i += 64) {
+    uint64_t bits = _mm512_cmpeq_epi8_mask(_mm512_loadu_si512(s + i), mask);
+    if (bits) return i + __builtin_ctzll(bits);
+  }
+  if (i == len) return -127;
+  __mmask64 in_string = (1ull << (len - i)) - 1;
+  uint64_t bits = _mm512_mask_cmpeq_epi8_mask(in_string, _mm512_maskz_loadu_epi8(in_string, s + i), mask);
+  return bits ? i + __builtin_ctzll(bits) : -127;
+}
+
+// Search for "*#" like test_exact_twobsse2, with masked loads of the stars
+// and the hashes for the positions left after the last whole block.
+__attribute__((target("avx512bw")))
+int test_exact_twobavx512(const char* s, int len) {
+  const uint512_t star_pattern = _mm512_set1_epi8('*');
+  const uint512_t hash_pattern = _mm512_set1_epi8('#');
+  int i = 0;
+  for ( ; i <= len - 65; i += 64) {
+    uint64_t stars = _mm512_cmpeq_epi8_mask(_mm512_loadu_si512(s + i), star_pattern);
+    uint64_t combined = _mm512_mask_cmpeq_epi8_mask(stars, _mm512_loadu_si512(s + i + 1), hash_pattern);
+    if (combined) return i + __builtin_ctzll(combined);
+  }
+  if (i >= len - 1) return -127;
+  __mmask64 positions = (1ull << (len - 1 - i)) - 1;
+  uint64_t stars = _mm512_mask_cmpeq_epi8_mask(positions, _mm512_maskz_loadu_epi8(positions, s + i), star_pattern);
+  uint64_t combined = _mm512_mask_cmpeq_epi8_mask(stars, _mm512_maskz_loadu_epi8(positions, s + i + 1), hash_pattern);
+  return combined ? i + __builtin_ctzll(combined) : -127;
+}
+
+// For the harness.
+static KernelInfo kernels[] = {
+  {"exact_sse2", test_exact_sse2, 1, ISA_SSE2, EXACT},
+  {"exact_twobsse2", test_exact_twobsse2, 2, ISA_SSE2, EXACT},
+  {"exact_avx2", test_exact_avx2, 1, ISA_AVX2, EXACT},
+  {"exact_twobavx2", test_exact_twobavx2, 2, ISA_AVX2, EXACT},
+  {"exact_avx512", test_exact_avx512, 1, ISA_AVX512BW, EXACT},
+  {"exact_twobavx512", test_exact_twobavx512, 2, ISA_AVX512BW, EXACT},
+};
@@ -0,0 +1,195 @@
+// Copyright 2018 Erik Corry.  See the LICENSE file, the BSD 2-clause
+// license.
+
+// Versions of the pure SSE2 and AVX2 routines that find every match instead
+// of stopping at the first one.  Restarting a search after each match costs
+// a call and a new alignment prologue, so splitting a buffer into lines that
+// way is slow.  These keep going to the end of the string, turning each
+// movemask into positions with a TZCNT/BLSR loop, so a block with several
+// matches is only loaded once.
+//
+// The find_all_ routines write the positions to a buffer given by the caller,
+// and return how many they wrote.  If that is max there may be more matches,
+// and the caller can search again from one after the last position.  The
+// count_ routines only count the matches.  Like the routines they are based
+// on, these may load data either side of the string, but only in aligned
+// blocks that are also covered by the string.
+
+#include <stdint.h>
+
+#include "search.h"
+
+// See test_pure_sse2.
+int find_all_pure_sse2(const Needle& n, const char* s, int len, int* positions, int max) {
+  int last_bits = (uintptr_t)s & 15;
+  int alignment_mask = 0xffff << last_bits;
+  const uint128_t mask = n.pattern;
+  int found = 0;
+  for (int i = -last_bits ; i < len; i += 16) {
+    uint128_t raw = *(uint128_t*)(s + i);
+    unsigned bits = _mm_movemask_epi8(_mm_cmpeq_epi8(raw, mask)) & alignment_mask;
+    // Drop the matches after the end of the string.
+    if (len - i < 16) bits &= (1u << (len - i)) - 1;
+    while (bits) {
+      if (found == max) return found;
+      positions[found++] = i + __builtin_ctz(bits);
+      bits &= bits - 1;
+    }
+    alignment_mask = 0xffff;
+  }
+  return found;
+}
+
+// See test_pure_sse2.  Must only be called if the CPU has POPCNT.
+__attribute__((target("popcnt")))
+int count_pure_sse2(const Needle& n, const char* s, int len) {
+  int last_bits = (uintptr_t)s & 15;
+  int alignment_mask = 0xffff << last_bits;
+  const uint128_t mask = n.pattern;
+  int count = 0;
+  for (int i = -last_bits ; i < len; i += 16) {
+    uint128_t raw = *(uint128_t*)(s + i);
+    unsigned bits = _mm_movemask_epi8(_mm_cmpeq_epi8(raw, mask)) & alignment_mask;
+    if (len - i < 16) bits &= (1u << (len - i)) - 1;
+    count += __builtin_popcount(bits);
+    alignment_mask = 0xffff;
+  }
+  return count;
+}
+
+// See test_pure_twobsse2.  Matches may overlap, so in "***" there are "**"
+// at 0 and 1.
+int find_all_pure_twobsse2(const Needle2& n, const char* s, int len, int* positions, int max) {
+  int last_bits = (uintptr_t)s & 15;
+  int alignment_mask = 0xffff << last_bits;
+  const uint128_t star_pattern = n.first_pattern;
+  const uint128_t hash_pattern = n.second_pattern;
+  int stars = 0;
+  int found = 0;
+  for (int i = -last_bits ; i < len; i += 16) {
+    uint128_t raw = *(uint128_t*)(s + i);
+    stars += (_mm_movemask_epi8(_mm_cmpeq_epi8(raw, star_pattern)) & alignment_mask) << 1;
+    int hashes = _mm_movemask_epi8(_mm_cmpeq_epi8(raw, hash_pattern));
+    // Bit k is set for a match at i + k - 1, which must be before len - 1.
+    unsigned combined = hashes & stars;
+    if (len - i < 16) combined &= (1u << (len - i)) - 1;
+    while (combined) {
+      if (found == max) return found;
+      positions[found++] = i + __builtin_ctz(combined) - 1;
+      combined &= combined - 1;
+    }
+    stars >>= 16;
+    alignment_mask = 0xffff;
+  }
+  return found;
+}
+
+// See test_pure_twobsse2.  Must only be called if the CPU has POPCNT.
+__attribute__((target("popcnt")))
+int count_pure_twobsse2(const Needle2& n, const char* s, int len) {
+  int last_bits = (uintptr_t)s & 15;
+  int alignment_mask = 0xffff << last_bits;
+  const uint128_t star_pattern = n.first_pattern;
+  const uint128_t hash_pattern = n.second_pattern;
+  int stars = 0;
+  int count = 0;
+  for (int i = -last_bits ; i < len; i += 16) {
+    uint128_t raw = *(uint128_t*)(s + i);
+    stars += (_mm_movemask_epi8(_mm_cmpeq_epi8(raw, star_pattern)) & alignment_mask) << 1;
+    int hashes = _mm_movemask_epi8(_mm_cmpeq_epi8(raw, hash_pattern));
+    unsigned combined = hashes & stars;
+    if (len - i < 16) combined &= (1u << (len - i)) - 1;
+    count += __builtin_popcount(combined);
+    stars >>= 16;
+    alignment_mask = 0xffff;
+  }
+  return count;
+}
+
+// See test_pure_avx2.
+__attribute__((target("avx2,bmi")))
+int find_all_pure_avx2(const Needle& n, const char* s, int len, int* positions, int max) {
+  int last_bits = (uintptr_t)s & 31;
+  uint32_t alignment_mask = 0xffffffffu << last_bits;
+  const uint256_t mask = _mm256_broadcastsi128_si256(n.pattern);
+  int found = 0;
+  for (int i = -last_bits ; i < len; i += 32) {
+    uint256_t raw = *(uint256_t*)(s + i);
+    uint32_t bits = _mm256_movemask_epi8(_mm256_cmpeq_epi8(raw, mask)) & alignment_mask;
+    if (len - i < 32) bits &= (1u << (len - i)) - 1;
+    while (bits) {
+      if (found == max) return found;
+      positions[found++] = i + __builtin_ctz(bits);
+      bits &= bits - 1;
+    }
+    alignment_mask = 0xffffffffu;
+  }
+  return found;
+}
+
+// See test_pure_avx2.
+__attribute__((target("avx2,popcnt")))
+int count_pure_avx2(const Needle& n, const char* s, int len) {
+  int last_bits = (uintptr_t)s & 31;
+  uint32_t alignment_mask = 0xffffffffu << last_bits;
+  const uint256_t mask = _mm256_broadcastsi128_si256(n.pattern);
+  int count = 0;
+  for (int i = -last_bits ; i < len; i += 32) {
+    uint256_t raw = *(uint256_t*)(s + i);
+    uint32_t bits = _mm256_movemask_epi8(_mm256_cmpeq_epi8(raw, mask)) & alignment_mask;
+    if (len - i < 32) bits &= (1u << (len - i)) - 1;
+    count += __builtin_popcount(bits);
+    alignment_mask = 0xffffffffu;
+  }
+  return count;
+}
+
+// See test_pure_twobavx2.
+__attribute__((target("avx2,bmi")))
+int find_all_pure_twobavx2(const Needle2& n, const char* s, int len, int* positions, int max) {
+  int last_bits = (uintptr_t)s & 31;
+  uint32_t alignment_mask = 0xffffffffu << last_bits;
+  const uint256_t star_pattern = _mm256_broadcastsi128_si256(n.first_pattern);
+  const uint256_t hash_pattern = _mm256_broadcastsi128_si256(n.second_pattern);
+  uint64_t stars = 0;
+  int found = 0;
+  for (int i = -last_bits ; i < len; i += 32) {
+    uint256_t raw = *(uint256_t*)(s + i);
+    uint32_t new_stars = _mm256_movemask_epi8(_mm256_cmpeq_epi8(raw, star_pattern));
+    stars += (uint64_t)(new_stars & alignment_mask) << 1;
+    uint32_t hashes = _mm256_movemask_epi8(_mm256_cmpeq_epi8(raw, hash_pattern));
+    uint32_t combined = hashes & (uint32_t)stars;
+    if (len - i < 32) combined &= (1u << (len - i)) - 1;
+    while (combined) {
+      if (found == max) return found;
+      positions[found++] = i + __builtin_ctz(combined) - 1;
+      combined &= combined - 1;
+    }
+    stars >>= 32;
+    alignment_mask = 0xffffffffu;
+  }
+  return found;
+}
+
+// See test_pure_twobavx2.
+__attribute__((target("avx2,popcnt")))
+int count_pure_twobavx2(const Needle2& n, const char* s, int len) {
+  int last_bits = (uintptr_t)s & 31;
+  uint32_t alignment_mask = 0xffffffffu << last_bits;
+  const uint256_t star_pattern = _mm256_broadcastsi128_si256(n.first_pattern);
+  const uint256_t hash_pattern = _mm256_broadcastsi128_si256(n.second_pattern);
+  uint64_t stars = 0;
+  int count = 0;
+  for (int i = -last_bits ; i < len; i += 32) {
+    uint256_t raw = *(uint256_t*)(s + i);
+    uint32_t new_stars = _mm256_movemask_epi8(_mm256_cmpeq_epi8(raw, star_pattern));
+    stars += (uint64_t)(new_stars & alignment_mask) << 1;
+    uint32_t hashes = _mm256_movemask_epi8(_mm256_cmpeq_epi8(raw, hash_pattern));
+    uint32_t combined = hashes & (uint32_t)stars;
+    if (len - i < 32) combined &= (1u << (len - i)) - 1;
+    count += __builtin_popcount(combined);
+    stars >>= 32;
+    alignment_mask = 0xffffffffu;
+  }
+  return count;
+}
@@ -0,0 +1,161 @@
+// Copyright 2018 Erik Corry.  See the LICENSE file, the BSD 2-clause
+// license.
+
+// The fastest search_ routines as inline functions, so that a caller that
+// searches many short strings, like a lexer, can have them compiled into its
+// loop.  There is then no call, and the patterns in the Needle are loaded
+// once for the loop instead of once per search.  search_pure_sse2 and the
+// others in needle.cc and avx2.cc are these, compiled out of line.  Include
+// search.h rather than this file.
+//
+// The AVX2 versions are only inlined into functions that are also compiled
+// for AVX2, with -mavx2 or __attribute__((target("avx2"))).  Anywhere else
+// they are called like any other function.
+
+#ifndef INLINE_H_
+#define INLINE_H_
+
+#include "search.h"
+
+// See test_pure_sse2.
+inline int inline_pure_sse2(const Needle& n, const char* s, int len) {
+  int last_bits = (uintptr_t)s & 15;
+  int alignment_mask = 0xffff << last_bits;
+  const uint128_t mask = n.pattern;
+  for (int i = -last_bits ; i < len; i += 16) {
+    uint128_t raw = *(uint128_t*)(s + i);
+    uint128_t comparison = _mm_cmpeq_epi8(raw, mask);
+    int bits = _mm_movemask_epi8(comparison) & alignment_mask;
+    if (bits) {
+      int answer = i + __builtin_ffs(bits) - 1;
+      if (answer >= len) return -127;
+      return answer;
+    }
+    alignment_mask = 0xffff;
+  }
+  return -127;
+}
+
+// See test_pure_twobsse2.
+inline int inline_pure_twobsse2(const Needle2& n, const char* s, int len) {
+  int last_bits = (uintptr_t)s & 15;
+  int alignment_mask = 0xffff << last_bits;
+  const uint128_t star_pattern = n.first_pattern;
+  const uint128_t hash_pattern = n.second_pattern;
+  int stars = 0;
+  for (int i = -last_bits ; i < len; i += 16) {
+    uint128_t raw = *(uint128_t*)(s + i);
+    stars += (_mm_movemask_epi8(_mm_cmpeq_epi8(raw, star_pattern)) & alignment_mask) << 1;
+    int hashes = _mm_movemask_epi8(_mm_cmpeq_epi8(raw, hash_pattern));
+    int combined = hashes & stars;
+    if (combined) {
+      int result = i + __builtin_ffs(combined) - 2;
+      if (result >= len - 1) return -127;
+      return result;
+    }
+    stars >>= 16;
+    alignment_mask = 0xffff;
+  }
+  return -127;
+}
+
+// See test_pure_mycroft.
+inline int inline_pure_mycroft(const Needle& n, const char* s, int len) {
+  int last_bits = (uintptr_t)s & 7;
+  int i = -last_bits;
+  const uint64_t mask = n.mask64;
+  // Bytes before the string are forced non-zero rather than just masked out
+  // of the result, otherwise the borrow from a match there can flag the
+  // byte after it.
+  uint64_t before = ~(~(uint64_t)0 << (last_bits << 3));
+  const uint64_t highs = 0x8080808080808080ul;
+  const uint64_t ones = 0x0101010101010101ul;
+  for ( ; i < len; i += 8) {
+    uint64_t raw = (*(uint64_t*)(s + i) ^ mask) | before;
+    raw = (raw - ones) & (~raw) & highs;
+    if (raw) {
+      int answer = i + (__builtin_ffsll(raw) >> 3) - 1;
+      if (answer >= len) return -127;
+      return answer;
+    }
+    before = 0;
+  }
+  return -127;
+}
+
+// See test_pure_mycroft2.
+inline int inline_pure_mycroft2(const Needle2& n, const char* s, int len) {
+  int last_bits = (uintptr_t)s & 7;
+  int i = -last_bits;
+  const uint64_t mask_star = n.first_mask64;
+  const uint64_t mask_hash = n.second_mask64;
+  uint64_t highs = 0x8080808080808080ul << (last_bits << 3);
+  const uint64_t lows = 0x7f7f7f7f7f7f7f7ful;
+  uint64_t stars_low = 0;
+  for ( ; i < len; i += 8) {
+    uint64_t raw = *(uint64_t*)(s + i);
+    uint64_t new_stars = raw ^ mask_star;
+    uint64_t hashes = raw ^ mask_hash;
+    // Unlike in the single byte versions, a false positive just after a
+    // real match is not harmless here, so use the form of the test that
+    // does not borrow between bytes.
+    new_stars = ~(((new_stars & lows) + lows) | new_stars) & highs;
+    hashes = ~(((hashes & lows) + lows) | hashes);
+    stars_low += new_stars << 8;
+    uint64_t combined = stars_low & hashes;
+    if (combined) {
+      int result = (i - 1) + (__builtin_ffsll(combined) >> 3) - 1;
+      if (result >= len - 1) return -127;
+      return result;
+    }
+    stars_low = new_stars >> 56;
+    highs = 0x8080808080808080ul;
+  }
+  return -127;
+}
+
+// See test_pure_avx2.
+__attribute__((target("avx2")))
+inline int inline_pure_avx2(const Needle& n, const char* s, int len) {
+  int last_bits = (uintptr_t)s & 31;
+  uint32_t alignment_mask = 0xffffffffu << last_bits;
+  const uint256_t mask = _mm256_broadcastsi128_si256(n.pattern);
+  for (int i = -last_bits ; i < len; i += 32) {
+    uint256_t raw = *(uint256_t*)(s + i);
+    uint32_t bits = _mm256_movemask_epi8(_mm256_cmpeq_epi8(raw, mask)) & alignment_mask;
+    if (bits) {
+      int answer = i + __builtin_ctz(bits);
+      if (answer >= len) return -127;
+      return answer;
+    }
+    alignment_mask = 0xffffffffu;
+  }
+  return -127;
+}
+
+// See test_pure_twobavx2.
+__attribute__((target("avx2")))
+inline int inline_pure_twobavx2(const Needle2& n, const char* s, int len) {
+  int last_bits = (uintptr_t)s & 31;
+  uint32_t alignment_mask = 0xffffffffu << last_bits;
+  const uint256_t star_pattern = _mm256_broadcastsi128_si256(n.first_pattern);
+  const uint256_t hash_pattern = _mm256_broadcastsi128_si256(n.second_pattern);
+  uint64_t stars = 0;
+  for (int i = -last_bits ; i < len; i += 32) {
+    uint256_t raw = *(uint256_t*)(s + i);
+    uint32_t new_stars = _mm256_movemask_epi8(_mm256_cmpeq_epi8(raw, star_pattern));
+    stars += (uint64_t)(new_stars & alignment_mask) << 1;
+    uint32_t hashes = _mm256_movemask_epi8(_mm256_cmpeq_epi8(raw, hash_pattern));
+    uint32_t combined = hashes & (uint32_t)stars;
+    if (combined) {
+      int result = i + __builtin_ctz(combined) - 1;
+      if (result >= len - 1) return -127;
+      return result;
+    }
+    stars >>= 32;
+    alignment_mask = 0xffffffffu;
+  }
+  return -127;
+}
+
+#endif  // INLINE_H_
@@ -0,0 +1,350 @@
+// Copyright 2018 Erik Corry.  See the LICENSE file, the BSD 2-clause
+// license.
+
+// The routines from search2.cc, but with the byte or bytes being searched for
+// given at runtime instead of compiled in.  The patterns are broadcast once
+// when the Needle is constructed, so each search does the same work as the
+// constant versions, except that the patterns are loaded from memory instead
+// of being immediates.
+
+#include <stdint.h>
+
+#include "search.h"
+
+Needle::Needle(char c) : c(c) {
+  pattern = _mm_set1_epi8(c);
+  mask64 = (uint8_t)c * 0x0101010101010101ul;
+  mask32 = (uint32_t)mask64;
+}
+
+Needle2::Needle2(char first, char second) : first(first), second(second) {
+  first_pattern = _mm_set1_epi8(first);
+  second_pattern = _mm_set1_epi8(second);
+  first_mask64 = (uint8_t)first * 0x0101010101010101ul;
+  second_mask64 = (uint8_t)second * 0x0101010101010101ul;
+}
+
+// See test_naive.
+int search_naive(const Needle& n, const char* s, int len) {
+  const char c = n.c;
+  for (int i = 0; i < len; i++) {
+    if (s[i] == c) {
+      return i;
+    }
+  }
+  return -127;
+}
+
+// See test_twobyte.
+int search_twobyte(const Needle2& n, const char* s, int len) {
+  const char first = n.first;
+  const char second = n.second;
+  len--;
+  for (int i = 0; i < len; i++) {
+    if (s[i] == first && s[i + 1] == second) {
+      return i;
+    }
+  }
+  return -127;
+}
+
+// inline_pure_sse2, out of line.
+int search_pure_sse2(const Needle& n, const char* s, int len) {
+  return inline_pure_sse2(n, s, len);
+}
+
+// See test_sse2.
+int search_sse2(const Needle& n, const char* s, int len) {
+  const char c = n.c;
+  int i = 0;
+  while (i < len) {
+    if (s[i] == c) {
+      return i;
+    }
+    i++;
+    if (((uintptr_t)(s + i) & 15) == 0) break;
+  }
+  if (i >= len) return -127;
+  const uint128_t mask = n.pattern;
+  for ( ; i < len; i += 16) {
+    uint128_t raw = *(uint128_t*)(s + i);
+    uint128_t comparison = _mm_cmpeq_epi8(raw, mask);
+    int bits = _mm_movemask_epi8(comparison);
+    if (bits) {
+      int answer = i + __builtin_ffs(bits) - 1;
+      if (answer >= len) return -127;
+      return answer;
+    }
+  }
+  return -127;
+}
+
+// See test_sse2_and_mycroft4.
+int search_sse2_and_mycroft4(const Needle& n, const char* s, int len) {
+  const char c = n.c;
+  int i = 0;
+  while (i < len) {
+    if (s[i] == c) {
+      return i;
+    }
+    i++;
+    if (((uintptr_t)(s + i) & 3) == 0) break;
+  }
+  if (i >= len) return -127;
+  const uint32_t mask32 = n.mask32;
+  const uint32_t highs = 0x80808080ul;
+  const uint32_t ones = 0x01010101ul;
+  while (i < len) {
+    uint32_t raw = *(uint32_t*)(s + i) ^ mask32;
+    raw = (raw - ones) & (~raw) & highs;
+    if (raw) {
+      int answer = i + (__builtin_ffs(raw) >> 3) - 1;
+      if (answer >= len) return -127;
+      return answer;
+    }
+    i += 4;
+    if (((uintptr_t)(s + i) & 15) == 0) break;
+  }
+  if (i >= len) return -127;
+  const uint128_t mask = n.pattern;
+  for ( ; i < len; i += 16) {
+    uint128_t raw = *(uint128_t*)(s + i);
+    uint128_t comparison = _mm_cmpeq_epi8(raw, mask);
+    int bits = _mm_movemask_epi8(comparison);
+    if (bits) {
+      int answer = i + __builtin_ffs(bits) - 1;
+      if (answer >= len) return -127;
+      return answer;
+    }
+  }
+  return -127;
+}
+
+// See test_twosse2.
+int search_twosse2(const Needle2& n, const char* s, int len) {
+  const char first = n.first;
+  const char second = n.second;
+  int i = 0;
+  while (i < len - 1) {
+    if (s[i] == first && s[i + 1] == second) {
+      return i;
+    }
+    i++;
+    if (((uintptr_t)(s + i) & 15) == 0) break;
+  }
+  if (i >= len - 1) return -127;
+  const uint128_t star_pattern = n.first_pattern;
+  const uint128_t hash_pattern = n.second_pattern;
+  int prev = (s[i - 1] == first) << 15;
+  for ( ; i < len; i += 16) {
+    uint128_t raw = *(uint128_t*)(s + i);
+    int stars = _mm_movemask_epi8(_mm_cmpeq_epi8(raw, star_pattern));
+    int hashes = _mm_movemask_epi8(_mm_cmpeq_epi8(raw, hash_pattern));
+    if ((prev & 0x8000) && (hashes & 1)) return i - 1;
+    int combined = (stars << 1) & hashes;
+    if (combined) {
+      int result = i + __builtin_ffs(combined) - 2;
+      if (result >= len - 1) return -127;
+      return result;
+    }
+    prev = stars;
+  }
+  return -127;
+}
+
+// See test_twobsse2.
+int search_twobsse2(const Needle2& n, const char* s, int len) {
+  const char first = n.first;
+  const char second = n.second;
+  int i = 0;
+  while (i < len - 1) {
+    if (s[i] == first && s[i + 1] == second) {
+      return i;
+    }
+    i++;
+    if (((uintptr_t)(s + i) & 15) == 0) break;
+  }
+  if (i >= len - 1) return -127;
+  const uint128_t star_pattern = n.first_pattern;
+  const uint128_t hash_pattern = n.second_pattern;
+  int stars = s[i - 1] == first;
+  for ( ; i < len; i += 16) {
+    uint128_t raw = *(uint128_t*)(s + i);
+    stars += _mm_movemask_epi8(_mm_cmpeq_epi8(raw, star_pattern)) << 1;
+    int hashes = _mm_movemask_epi8(_mm_cmpeq_epi8(raw, hash_pattern));
+    if (hashes & stars) {
+      int result = i + __builtin_ffs(hashes & stars) - 2;
+      if (result >= len - 1) return -127;
+      return result;
+    }
+    stars >>= 16;
+  }
+  return -127;
+}
+
+// inline_pure_twobsse2, out of line.
+int search_pure_twobsse2(const Needle2& n, const char* s, int len) {
+  return inline_pure_twobsse2(n, s, len);
+}
+
+// See search_for_double_underscore.
+int search_pure_doublesse2(const Needle& n, const char* s, int len) {
+  int last_bits = (uintptr_t)s & 15;
+  int alignment_mask = 0xffff << last_bits;
+  const uint128_t pattern = n.pattern;
+  int first_char = 0;
+  for (int i = -last_bits ; i < len; i += 16) {
+    uint128_t raw = *(uint128_t*)(s + i);
+    int second_char = _mm_movemask_epi8(_mm_cmpeq_epi8(raw, pattern));
+    first_char += (second_char & alignment_mask) << 1;
+    int combined = first_char & second_char;
+    if (combined) {
+      int result = i + __builtin_ffs(combined) - 2;
+      if (result >= len - 1) return -127;
+      return result;
+    }
+    first_char >>= 16;
+    alignment_mask = 0xffff;
+  }
+  return -127;
+}
+
+// See test_mycroft4.
+int search_mycroft4(const Needle& n, const char* s, int len) {
+  const char c = n.c;
+  int i = 0;
+  while (i < len) {
+    if (s[i] == c) {
+      return i;
+    }
+    i++;
+    if (((uintptr_t)(s + i) & 3) == 0) break;
+  }
+  if (i >= len) return -127;
+  const uint32_t mask = n.mask32;
+  const uint32_t highs = 0x80808080ul;
+  const uint32_t ones = 0x01010101ul;
+  for ( ; i < len; i += 4) {
+    uint32_t raw = *(uint32_t*)(s + i) ^ mask;
+    raw = (raw - ones) & (~raw) & highs;
+    if (raw) {
+      int answer = i + (__builtin_ffs(raw) >> 3) - 1;
+      if (answer >= len) return -127;
+      return answer;
+    }
+  }
+  return -127;
+}
+
+// See test_pure_mycroft4.
+int search_pure_mycroft4(const Needle& n, const char* s, int len) {
+  int last_bits = (uintptr_t)s & 3;
+  int i = -last_bits;
+  const uint32_t mask = n.mask32;
+  // Bytes before the string are forced non-zero rather than just masked out
+  // of the result, otherwise the borrow from a match there can flag the
+  // byte after it.
+  uint32_t before = ~(~(uint32_t)0 << (last_bits << 3));
+  const uint32_t highs = 0x80808080ul;
+  const uint32_t ones = 0x01010101ul;
+  for ( ; i < len; i += 4) {
+    uint32_t raw = (*(uint32_t*)(s + i) ^ mask) | before;
+    raw = (raw - ones) & (~raw) & highs;
+    if (raw) {
+      int answer = i + (__builtin_ffs(raw) >> 3) - 1;
+      if (answer >= len) return -127;
+      return answer;
+    }
+    before = 0;
+  }
+  return -127;
+}
+
+// See test_mycroft.
+int search_mycroft(const Needle& n, const char* s, int len) {
+  const char c = n.c;
+  int i = 0;
+  while (i < len) {
+    if (s[i] == c) {
+      return i;
+    }
+    i++;
+    if (((uintptr_t)(s + i) & 7) == 0) break;
+  }
+  if (i >= len) return -127;
+  const uint64_t mask = n.mask64;
+  const uint64_t highs = 0x8080808080808080ul;
+  const uint64_t ones = 0x0101010101010101ul;
+  for ( ; i < len; i += 8) {
+    uint64_t raw = *(uint64_t*)(s + i) ^ mask;
+    raw = (raw - ones) & (~raw) & highs;
+    if (raw) {
+      int answer = i + (__builtin_ffsll(raw) >> 3) - 1;
+      if (answer >= len) return -127;
+      return answer;
+    }
+  }
+  return -127;
+}
+
+// inline_pure_mycroft, out of line.
+int search_pure_mycroft(const Needle& n, const char* s, int len) {
+  return inline_pure_mycroft(n, s, len);
+}
+
+// See test_mycroft2.
+int search_mycroft2(const Needle2& n, const char* s, int len) {
+  const char first = n.first;
+  const char second = n.second;
+  int i = 0;
+  while (i < len - 1) {
+    if (s[i] == first && s[i + 1] == second) {
+      return i;
+    }
+    i++;
+    if (((uintptr_t)(s + i) & 7) == 0) break;
+  }
+  if (i >= len - 1) return -127;
+  const uint64_t mask_star = n.first_mask64;
+  const uint64_t mask_hash = n.second_mask64;
+  const uint64_t highs = 0x8080808080808080ul;
+  const uint64_t lows = 0x7f7f7f7f7f7f7f7ful;
+  for ( ; i < len; i += 8) {
+    uint64_t raw = *(uint64_t*)(s + i - 1) ^ mask_star;
+    uint64_t raw2 = *(uint64_t*)(s + i) ^ mask_hash;
+    // See test_pure_mycroft2 for why this does not use (x - ones) & ~x.
+    raw = ~(((raw & lows) + lows) | raw);
+    raw2 = ~(((raw2 & lows) + lows) | raw2);
+    uint64_t combined = raw & raw2 & highs;
+    if (combined) {
+      int result = (i - 1) + (__builtin_ffsll(combined) >> 3) - 1;
+      if (result >= len - 1) return -127;
+      return result;
+    }
+  }
+  return -127;
+}
+
+// inline_pure_mycroft2, out of line.
+int search_pure_mycroft2(const Needle2& n, const char* s, int len) {
+  return inline_pure_mycroft2(n, s, len);
+}
+
+// The search_ routines, for the harness.  search_pure_doublesse2 needs a
+// needle with the same byte twice, so it is not registered.
+static KernelInfo kernels[] = {
+  {"naive", ByteSearch<search_naive>(), ISA_SSE2, EXACT},
+  {"pure_mycroft4", ByteSearch<search_pure_mycroft4>(), ISA_SSE2, ALIGNED},
+  {"mycroft4", ByteSearch<search_mycroft4>(), ISA_SSE2, ALIGNED},
+  {"mycroft", ByteSearch<search_mycroft>(), ISA_SSE2, ALIGNED},
+  {"pure_mycroft", ByteSearch<search_pure_mycroft>(), ISA_SSE2, ALIGNED},
+  {"pure_sse2", ByteSearch<search_pure_sse2>(), ISA_SSE2, ALIGNED},
+  {"sse2", ByteSearch<search_sse2>(), ISA_SSE2, ALIGNED},
+  {"sse2_and_mycroft4", ByteSearch<search_sse2_and_mycroft4>(), ISA_SSE2, ALIGNED},
+  {"twobyte", PairSearch<search_twobyte>(), ISA_SSE2, EXACT},
+  {"mycroft2", PairSearch<search_mycroft2>(), ISA_SSE2, ALIGNED},
+  {"pure_mycroft2", PairSearch<search_pure_mycroft2>(), ISA_SSE2, ALIGNED},
+  {"twosse2", PairSearch<search_twosse2>(), ISA_SSE2, ALIGNED},
+  {"twobsse2", PairSearch<search_twobsse2>(), ISA_SSE2, ALIGNED},
+  {"pure_twobsse2", PairSearch<search_pure_twobsse2>(), ISA_SSE2, ALIGNED},
+};
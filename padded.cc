@@ -0,0 +1,90 @@
+// Copyright 2018 Erik Corry.  See the LICENSE file, the BSD 2-clause
+// license.
+
+// Searching strings in buffers that the caller promises have 64 readable
+// bytes before and after them, as a buffer from an allocator that pads
+// every allocation has.  The kernels load from s, s + 16 and so on with
+// unaligned loads, which may read up to a block past the end of the
+// string, so there is no alignment mask, no first block before the string,
+// and no check of which page a load is in.
+
+#include <stdint.h>
+
+#include "search.h"
+
+// See test_pure_sse2.  The first load is at s, so the bits of every load
+// are for the bytes from s + i.
+int test_padded_sse2(const char* s, int len) {
+  const uint128_t mask = _mm_set1_epi8('*');
+  for (int i = 0; i < len; i += 16) {
+    uint128_t raw = _mm_loadu_si128((const uint128_t*)(s + i));
+    int bits = _mm_movemask_epi8(_mm_cmpeq_epi8(raw, mask));
+    if (bits) {
+      int answer = i + __builtin_ctz(bits);
+      if (answer >= len) return -127;
+      return answer;
+    }
+  }
+  return -127;
+}
+
+// Search for "*#" by comparing the bytes from s + i with '*' and the bytes
+// from s + i + 1 with '#'.  The second load overlaps the first, so bit n of
+// both is for a match at i + n, and no star is carried between blocks.
+int test_padded_twobsse2(const char* s, int len) {
+  const uint128_t star_pattern = _mm_set1_epi8('*');
+  const uint128_t hash_pattern = _mm_set1_epi8('#');
+  for (int i = 0; i < len - 1; i += 16) {
+    uint128_t stars = _mm_cmpeq_epi8(_mm_loadu_si128((const uint128_t*)(s + i)), star_pattern);
+    uint128_t hashes = _mm_cmpeq_epi8(_mm_loadu_si128((const uint128_t*)(s + i + 1)), hash_pattern);
+    int combined = _mm_movemask_epi8(_mm_and_si128(stars, hashes));
+    if (combined) {
+      int result = i + __builtin_ctz(combined);
+      if (result >= len - 1) return -127;
+      return result;
+    }
+  }
+  return -127;
+}
+
+// test_padded_sse2 with 32 byte loads.
+__attribute__((target("avx2")))
+int test_padded_avx2(const char* s, int len) {
+  const uint256_t mask = _mm256_set1_epi8('*');
+  for (int i = 0; i < len; i += 32) {
+    uint256_t raw = _mm256_loadu_si256((const uint256_t*)(s + i));
+    uint32_t bits = _mm256_movemask_epi8(_mm256_cmpeq_epi8(raw, mask));
+    if (bits) {
+      int answer = i + __builtin_ctz(bits);
+      if (answer >= len) return -127;
+      return answer;
+    }
+  }
+  return -127;
+}
+
+// test_padded_twobsse2 with 32 byte loads.
+__attribute__((target("avx2")))
+int test_padded_twobavx2(const char* s, int len) {
+  const uint256_t star_pattern = _mm256_set1_epi8('*');
+  const uint256_t hash_pattern = _mm256_set1_epi8('#');
+  for (int i = 0; i < len - 1; i += 32) {
+    uint256_t stars = _mm256_cmpeq_epi8(_mm256_loadu_si256((const uint256_t*)(s + i)), star_pattern);
+    uint256_t hashes = _mm256_cmpeq_epi8(_mm256_loadu_si256((const uint256_t*)(s + i + 1)), hash_pattern);
+    uint32_t combined = _mm256_movemask_epi8(_mm256_and_si256(stars, hashes));
+    if (combined) {
+      int result = i + __builtin_ctz(combined);
+      if (result >= len - 1) return -127;
+      return result;
+    }
+  }
+  return -127;
+}
+
+// For the harness, which only calls them on padded strings.
+static KernelInfo kernels[] = {
+  {"padded_sse2", test_padded_sse2, 1, ISA_SSE2, PADDED},
+  {"padded_twobsse2", test_padded_twobsse2, 2, ISA_SSE2, PADDED},
+  {"padded_avx2", test_padded_avx2, 1, ISA_AVX2, PADDED},
+  {"padded_twobavx2", test_padded_twobavx2, 2, ISA_AVX2, PADDED},
+};
@@ -0,0 +1,147 @@
+// Copyright 2018 Erik Corry.  See the LICENSE file, the BSD 2-clause
+// license.
+
+// Searching a big buffer on several threads.  One core searching with SSE2
+// can't use all the memory bandwidth, so the buffer is split into chunks that
+// start on cache line boundaries, and the threads take chunks in order from
+// the left.  When a thread finds a match, the chunks to the right of it are
+// no longer needed, so threads stop taking chunks once they reach the best
+// match so far.  Chunks to the left are still searched, because they may
+// have an earlier match.
+//
+// A two-byte match can start in one chunk and end in the next.  Each chunk is
+// searched with the stream routines, starting with the carry bit set if the
+// byte before the chunk is the first byte of the needle, so a match that
+// straddles two chunks is found by the right hand one, at -1.
+
+#include <limits.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "search.h"
+
+struct PoolState {
+  std::vector<std::thread> workers;
+  std::mutex mutex;
+  std::condition_variable start;
+  std::condition_variable done;
+  int generation = 0;
+  int busy = 0;
+  bool stop = false;
+  bool avx2 = false;
+
+  // The current search.
+  const Needle* needle = nullptr;
+  const Needle2* needle2 = nullptr;
+  const char* s = nullptr;
+  long long len = 0;
+  long long chunk_size = 0;
+  long long first_chunk_end = 0;
+  long long chunks = 0;
+  std::atomic<long long> next_chunk;
+  std::atomic<long long> best;
+
+  void work();
+  void worker();
+};
+
+// Search chunks until they run out or are to the right of the best match.
+void PoolState::work() {
+  while (true) {
+    long long k = next_chunk.fetch_add(1);
+    if (k >= chunks) return;
+    long long start = k == 0 ? 0 : first_chunk_end + (k - 1) * chunk_size;
+    if (start >= best.load(std::memory_order_relaxed)) return;
+    long long end = first_chunk_end + k * chunk_size;
+    if (end > len) end = len;
+    int found;
+    if (needle) {
+      found = search_byte(*needle, s + start, end - start);
+    } else {
+      StreamState state;
+      state.carry = start > 0 && s[start - 1] == needle2->first;
+      found = avx2 ? stream_pure_twobavx2(*needle2, &state, s + start, end - start)
+                   : stream_pure_twobsse2(*needle2, &state, s + start, end - start);
+    }
+    if (found != -127) {
+      long long position = start + found;
+      long long previous = best.load();
+      while (position < previous && !best.compare_exchange_weak(previous, position)) {}
+      return;
+    }
+  }
+}
+
+void PoolState::worker() {
+  int seen = 0;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      start.wait(lock, [&] { return stop || generation != seen; });
+      if (stop) return;
+      seen = generation;
+    }
+    work();
+    std::lock_guard<std::mutex> lock(mutex);
+    if (--busy == 0) done.notify_all();
+  }
+}
+
+SearchPool::SearchPool(int threads, int chunk_size) : state_(new PoolState) {
+  state_->avx2 = __builtin_cpu_supports("avx2");
+  // Chunks are a whole number of cache lines.
+  state_->chunk_size = chunk_size < 64 ? 64 : chunk_size & ~63;
+  // The calling thread searches too.
+  for (int i = 1; i < threads; i++) {
+    state_->workers.push_back(std::thread(&PoolState::worker, state_));
+  }
+}
+
+SearchPool::~SearchPool() {
+  {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    state_->stop = true;
+  }
+  state_->start.notify_all();
+  for (std::thread& worker : state_->workers) worker.join();
+  delete state_;
+}
+
+long long SearchPool::run(const Needle* n, const Needle2* n2, const char* s, long long len) {
+  PoolState* state = state_;
+  state->needle = n;
+  state->needle2 = n2;
+  state->s = s;
+  state->len = len;
+  // The first chunk ends on a cache line boundary, so the rest start on one.
+  long long to_line = (64 - ((uintptr_t)s & 63)) & 63;
+  state->first_chunk_end = to_line + state->chunk_size;
+  if (state->first_chunk_end > len) state->first_chunk_end = len;
+  state->chunks = 1 + (len - state->first_chunk_end + state->chunk_size - 1) / state->chunk_size;
+  state->next_chunk = 0;
+  state->best = LLONG_MAX;
+  {
+    std::lock_guard<std::mutex> lock(state->mutex);
+    state->busy = state->workers.size();
+    state->generation++;
+  }
+  state->start.notify_all();
+  state->work();
+  std::unique_lock<std::mutex> lock(state->mutex);
+  state->done.wait(lock, [&] { return state->busy == 0; });
+  return state->best == LLONG_MAX ? -127 : (long long)state->best;
+}
+
+long long SearchPool::search_byte(const Needle& n, const char* s, long long len) {
+  return run(&n, nullptr, s, len);
+}
+
+long long SearchPool::search_pair(const Needle2& n, const char* s, long long len) {
+  if (len < 2) return -127;
+  return run(nullptr, &n, s, len);
+}
@@ -0,0 +1,41 @@
+// Copyright 2018 Erik Corry.  See the LICENSE file, the BSD 2-clause
+// license.
+
+// The list of registered kernels.  The KernelInfos are static objects in the
+// files with the kernels, and are added to the end of the list by their
+// constructors.  The list head is constant initialized, so it is ready before
+// any of them run.
+
+#include "search.h"
+
+const KernelInfo* KernelInfo::first = 0;
+static const KernelInfo** last = &KernelInfo::first;
+
+static void add(KernelInfo* kernel) {
+  kernel->next = 0;
+  *last = kernel;
+  last = &kernel->next;
+}
+
+Needle KernelInfo::needle('*');
+Needle2 KernelInfo::needle2('*', '#');
+
+KernelInfo::KernelInfo(const char* name, int (*fixed)(const char*, int), int bytes, int isa, OverRead over_read)
+    : name(name), fixed(fixed), byte(0), pair(0), direct(0), bytes(bytes), isa(isa), over_read(over_read) {
+  add(this);
+}
+
+KernelInfo::KernelInfo(const char* name, int (*byte)(const Needle&, const char*, int),
+                       int (*pair)(const Needle2&, const char*, int),
+                       int (*direct)(const char*, int), int bytes, int isa, OverRead over_read)
+    : name(name), fixed(0), byte(byte), pair(pair), direct(direct), bytes(bytes), isa(isa), over_read(over_read) {
+  add(this);
+}
+
+bool KernelInfo::supported() const {
+  if ((isa & ISA_SSSE3) && !__builtin_cpu_supports("ssse3")) return false;
+  if ((isa & ISA_POPCNT) && !__builtin_cpu_supports("popcnt")) return false;
+  if ((isa & ISA_AVX2) && !__builtin_cpu_supports("avx2")) return false;
+  if ((isa & ISA_AVX512BW) && !__builtin_cpu_supports("avx512bw")) return false;
+  return true;
+}
@@ -0,0 +1,248 @@
+// Copyright 2018 Erik Corry.  See the LICENSE file, the BSD 2-clause
+// license.
+
+// A grep-like tool that searches files for one or two bytes with the fastest
+// routines the CPU supports, to measure throughput on real files.
+//
+//   scan [-c | -a] [-t] BYTES FILE...
+//
+// BYTES is one or two bytes, and can use \n, \r, \t, \\ and \xHH.  By default
+// the offset of the first match in each file is printed.  With -c the matches
+// are counted, and with -a the offset of every match is printed.  Two-byte
+// matches may overlap.  With -t the time taken and the throughput are printed
+// on stderr, and the file is also scanned with read() into a buffer, for
+// comparison with the default, which is to map the file with mmap.
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "search.h"
+
+enum Mode { FIRST, COUNT, ALL };
+
+static Mode mode = FIRST;
+static bool print_all = true;
+static int bytes;
+static Needle needle(0);
+static Needle2 needle2(0, 0);
+static bool avx2;
+static bool popcnt;
+
+// The kernels take an int length, so big files are searched in pieces of
+// this size.  A two-byte search is given one extra byte so it can find a
+// match that starts at the end of a piece.
+static const long long PIECE = 1 << 30;
+
+// The size of the buffer for read().
+static const int READ_SIZE = 1 << 20;
+
+// The positions from find_all_, printed a batch at a time.
+static int positions[4096];
+
+// The result of searching a piece, or of a whole file.
+struct Result {
+  long long first;  // The first match, or -1.
+  long long count;  // The number of matches, for COUNT and ALL.
+};
+
+// Search len bytes at s, which are at offset in the file.  For two bytes,
+// s[len] is the byte after the piece, if there is one, and more is 1.
+static void search_piece(const char* s, int len, int more, long long offset, Result* result, const char* name) {
+  if (mode == FIRST) {
+    if (result->first >= 0) return;
+    int found = bytes == 1 ? search_byte(needle, s, len) : search_pair(needle2, s, len + more);
+    if (found >= 0) result->first = offset + found;
+  } else if (mode == COUNT && popcnt) {
+    if (bytes == 1) {
+      result->count += avx2 ? count_pure_avx2(needle, s, len) : count_pure_sse2(needle, s, len);
+    } else {
+      result->count += avx2 ? count_pure_twobavx2(needle2, s, len + more) : count_pure_twobsse2(needle2, s, len + more);
+    }
+  } else {
+    // Find every match, restarting after a full batch of positions.
+    int start = 0;
+    while (true) {
+      int found;
+      if (bytes == 1) {
+        found = avx2 ? find_all_pure_avx2(needle, s + start, len - start, positions, 4096)
+                     : find_all_pure_sse2(needle, s + start, len - start, positions, 4096);
+      } else {
+        found = avx2 ? find_all_pure_twobavx2(needle2, s + start, len + more - start, positions, 4096)
+                     : find_all_pure_twobsse2(needle2, s + start, len + more - start, positions, 4096);
+      }
+      if (mode == ALL && print_all) {
+        for (int i = 0; i < found; i++) printf("%s:%lld\n", name, offset + start + positions[i]);
+      }
+      result->count += found;
+      if (found < 4096) break;
+      start += positions[found - 1] + 1;
+    }
+  }
+}
+
+static bool scan_mmap(int fd, long long size, Result* result, const char* name) {
+  if (size == 0) return true;
+  const char* data = (const char*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data == MAP_FAILED) {
+    perror(name);
+    return false;
+  }
+  madvise((void*)data, size, MADV_SEQUENTIAL);
+  for (long long offset = 0; offset < size; offset += PIECE) {
+    long long len = size - offset < PIECE ? size - offset : PIECE;
+    int more = bytes == 2 && offset + len < size;
+    search_piece(data + offset, len, more, offset, result, name);
+  }
+  munmap((void*)data, size);
+  return true;
+}
+
+// The last byte of each buffer is kept at the start of the next one, so that
+// a two-byte match can be found across the boundary.
+static bool scan_read(int fd, Result* result, const char* name) {
+  static char* buffer = (char*)malloc(READ_SIZE + 1);
+  long long offset = 0;
+  int kept = 0;
+  while (true) {
+    ssize_t got = read(fd, buffer + kept, READ_SIZE);
+    if (got < 0) {
+      perror(name);
+      return false;
+    }
+    if (got == 0) break;
+    search_piece(buffer, got + kept - (bytes == 2 ? 1 : 0), bytes == 2 ? 1 : 0, offset - kept, result, name);
+    if (mode == FIRST && result->first >= 0) break;
+    offset += got;
+    if (bytes == 2) {
+      buffer[0] = buffer[got + kept - 1];
+      kept = 1;
+    }
+  }
+  return true;
+}
+
+static double now() {
+  struct timeval tv;
+  gettimeofday(&tv, 0);
+  return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+static void report(const char* how, long long size, double seconds) {
+  fprintf(stderr, "%s: %lld bytes in %.1fms, %.2f GB/s\n",
+          how, size, seconds * 1000, size / seconds / 1e9);
+}
+
+// Parses the escapes in BYTES.  Returns the number of bytes, or 0 if there
+// are not one or two of them.
+static int parse(const char* arg, char* out) {
+  int count = 0;
+  for (const char* p = arg; *p; p++) {
+    if (count == 2) return 0;
+    char c = *p;
+    if (c == '\\' && p[1]) {
+      p++;
+      switch (*p) {
+        case 'n': c = '\n'; break;
+        case 'r': c = '\r'; break;
+        case 't': c = '\t'; break;
+        case 'x': {
+          char hex[3] = {0};
+          for (int i = 0; i < 2 && isxdigit(p[1]); i++) hex[i] = *++p;
+          c = strtol(hex, NULL, 16);
+          break;
+        }
+        default: c = *p; break;
+      }
+    }
+    out[count++] = c;
+  }
+  return count;
+}
+
+static void usage() {
+  fprintf(stderr, "Usage: scan [-c | -a] [-t] BYTES FILE...\n");
+  exit(2);
+}
+
+int main(int argc, char** argv) {
+  bool timing = false;
+  int arg = 1;
+  for ( ; arg < argc && argv[arg][0] == '-' && argv[arg][1]; arg++) {
+    if (strcmp(argv[arg], "-c") == 0) {
+      mode = COUNT;
+    } else if (strcmp(argv[arg], "-a") == 0) {
+      mode = ALL;
+    } else if (strcmp(argv[arg], "-t") == 0) {
+      timing = true;
+    } else {
+      usage();
+    }
+  }
+  if (argc - arg < 2) usage();
+  char pattern[2];
+  bytes = parse(argv[arg++], pattern);
+  if (bytes == 0) usage();
+  needle = Needle(pattern[0]);
+  needle2 = Needle2(pattern[0], pattern[1]);
+  avx2 = __builtin_cpu_supports("avx2");
+  popcnt = __builtin_cpu_supports("popcnt");
+
+  int status = 1;
+  for ( ; arg < argc; arg++) {
+    const char* name = argv[arg];
+    int fd = open(name, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+      perror(name);
+      status = 2;
+      continue;
+    }
+    // When timing, print every match first, so that printing is not timed.
+    if (timing && mode == ALL) {
+      Result printed = {-1, 0};
+      scan_mmap(fd, st.st_size, &printed, name);
+      print_all = false;
+    }
+    Result result = {-1, 0};
+    double start = now();
+    if (!scan_mmap(fd, st.st_size, &result, name)) {
+      status = 2;
+      close(fd);
+      continue;
+    }
+    double seconds = now() - start;
+    if (mode == FIRST) {
+      if (result.first >= 0) printf("%s:%lld\n", name, result.first);
+    } else if (mode == COUNT) {
+      printf("%s:%lld\n", name, result.count);
+    }
+    if (status == 1 && (result.first >= 0 || result.count > 0)) status = 0;
+    if (timing) {
+      // A search for the first match stops there.
+      long long scanned = st.st_size;
+      if (mode == FIRST && result.first >= 0) scanned = result.first + bytes;
+      report("mmap", scanned, seconds);
+      Result again = {-1, 0};
+      lseek(fd, 0, SEEK_SET);
+      start = now();
+      scan_read(fd, &again, name);
+      seconds = now() - start;
+      report("read", scanned, seconds);
+      if (again.first != result.first || again.count != result.count) {
+        fprintf(stderr, "%s: read() found %lld/%lld, but mmap found %lld/%lld\n", name,
+                again.first, again.count, result.first, result.count);
+      }
+      print_all = true;
+    }
+    close(fd);
+  }
+  return status;
+}
@@ -3,37 +3,76 @@
 
 // Test harness for the searching routines.
 
+#include <errno.h>
+#include <math.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
+#include <unistd.h>
 
-#include <sys/time.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
 
 #include "search.h"
 
 void set_up();
 
+typedef int searcher(const char* s, int len);
+
 const char* small = 0;
 const char* large = 0;
 
 int small_length;
 int large_length;
 
+// Where the two-byte needle is planted in the small and large inputs.
+static int small_match;
+static int large_match;
+
 static int random_offsets[4096];
 
+// The bytes that test() and time() plant in their inputs.  The test_
+// routines only ever look for '*' and '#', but the search_ routines look for
+// whatever needle and needle2 have been prepared with.
+static char needle_first = '*';
+static char needle_second = '#';
+static Needle needle('*');
+static Needle2 needle2('*', '#');
+
 void set_up() {
-  static const char* sm = "Now is the time *# for all good men";
+  // Both inputs have 64 bytes of padding either side, for the padded
+  // kernels.
+  static const char text[] = "Now is the time *# for all good men";
+  static char padded_small[64 + sizeof(text) + 64];
+  char* sm = padded_small + 64;
+  memcpy(sm, text, sizeof(text));
   small = sm;
   small_length = strlen(sm);
+  small_match = strchr(sm, '*') - sm;
 
   srandom(314159);
   for (int i = 0; i < 4096; i++) {
     random_offsets[i] = random();
   }
 
+  // With a null byte after it, for strchr and strstr.
   int LONG = 10000;
-  char* l = (char*)malloc(LONG);
+  char* l = (char*)calloc(64 + LONG + 1 + 64, 1) + 64;
+  l[LONG] = '\0';
   large_length = LONG;
   for (int i = 0; i < LONG; i += 4) {
     l[i] = 'F';
@@ -42,36 +81,627 @@ void set_up() {
     l[i + 3] = ' ';
   }
 
-  l[(LONG * 3) / 4] = '*';
-  l[(LONG * 3) / 4 + 1] = '#';
+  large_match = (LONG * 3) / 4;
+  l[large_match] = '*';
+  l[large_match + 1] = '#';
 
   large = l;
 }
 
-typedef int searcher(const char* s, int len);
+// The two-byte needle for the std::search baselines, with searchers made for
+// it by use_needle().
+static char pair_bytes[3] = {'*', '#', '\0'};
+static std::boyer_moore_searcher<const char*> boyer_moore_pair(pair_bytes, pair_bytes + 2);
+static std::boyer_moore_horspool_searcher<const char*> horspool_pair(pair_bytes, pair_bytes + 2);
+
+// Switch the search_ routines to a different needle, and replant it in the
+// small and large inputs so that time() finds it in the same place as the
+// '*#' that the test_ routines look for.  The bytes should not occur in the
+// rest of the inputs.
+void use_needle(char first, char second) {
+  needle_first = first;
+  needle_second = second;
+  needle = Needle(first);
+  needle2 = Needle2(first, second);
+  KernelInfo::needle = needle;
+  KernelInfo::needle2 = needle2;
+  pair_bytes[0] = first;
+  pair_bytes[1] = second;
+  boyer_moore_pair = std::boyer_moore_searcher<const char*>(pair_bytes, pair_bytes + 2);
+  horspool_pair = std::boyer_moore_horspool_searcher<const char*>(pair_bytes, pair_bytes + 2);
+  char* sm = (char*)small;
+  char* l = (char*)large;
+  sm[small_match] = first;
+  sm[small_match + 1] = second;
+  l[large_match] = first;
+  l[large_match + 1] = second;
+}
+
+template<int (*fn)(const Needle&, const char*, int)>
+int with_needle(const char* s, int len) {
+  return fn(needle, s, len);
+}
+
+template<int (*fn)(const Needle2&, const char*, int)>
+int with_needle2(const char* s, int len) {
+  return fn(needle2, s, len);
+}
+
+// The set of bytes for the search_set_ routines, and a Needle for each of
+// its bytes, for comparing with searching for them one at a time.
+static ByteSet byte_set("*", 1);
+static std::vector<Needle> set_needles;
+
+template<int (*fn)(const ByteSet&, const char*, int)>
+int with_set(const char* s, int len) {
+  return fn(byte_set, s, len);
+}
+
+// Find the first byte of the set by searching for each of its bytes in turn
+// with search_pure_sse2, each time only up to the best match so far.
+int chained_pure_sse2(const char* s, int len) {
+  int best = -127;
+  for (const Needle& n : set_needles) {
+    int found = search_pure_sse2(n, s, len);
+    if (found >= 0) {
+      best = found;
+      len = found;
+    }
+  }
+  return best;
+}
+
+// The C library and the C++ standard library, for comparison, searching
+// for the needle and returning -127 if it isn't found like the kernels.
+int libc_memchr(const char* s, int len) {
+  const char* found = (const char*)memchr(s, needle_first, len);
+  return found ? found - s : -127;
+}
+
+int libc_memmem(const char* s, int len) {
+  const char* found = (const char*)memmem(s, len, pair_bytes, 2);
+  return found ? found - s : -127;
+}
+
+// strchr and strstr don't take a length, so these can only search strings
+// that end with a null byte at s[len] and have none before it.
+int libc_strchr(const char* s, int len) {
+  const char* found = strchr(s, needle_first);
+  return found && found < s + len ? found - s : -127;
+}
+
+int libc_strstr(const char* s, int len) {
+  const char* found = strstr(s, pair_bytes);
+  return found ? found - s : -127;
+}
+
+// The sentinel kernels, which only see the null byte at s[len].
+int sentinel_byte(const char* s, int len) {
+  const char* found = sentinel_pure_sse2(s);
+  return *found ? found - s : -127;
+}
+
+int sentinel_pair(const char* s, int len) {
+  const char* found = sentinel_pure_twobsse2(s);
+  return *found ? found - s : -127;
+}
+
+int string_view_find(const char* s, int len) {
+  size_t found = std::string_view(s, len).find(needle_first);
+  return found == std::string_view::npos ? -127 : found;
+}
+
+int string_view_find2(const char* s, int len) {
+  size_t found = std::string_view(s, len).find(std::string_view(pair_bytes, 2));
+  return found == std::string_view::npos ? -127 : found;
+}
+
+int std_find(const char* s, int len) {
+  const char* found = std::find(s, s + len, needle_first);
+  return found == s + len ? -127 : found - s;
+}
+
+int std_search_boyer_moore(const char* s, int len) {
+  const char* found = std::search(s, s + len, boyer_moore_pair);
+  return found == s + len ? -127 : found - s;
+}
+
+int std_search_horspool(const char* s, int len) {
+  const char* found = std::search(s, s + len, horspool_pair);
+  return found == s + len ? -127 : found - s;
+}
+
+// What test() checks single byte searches against.
+static searcher* reference = with_needle<search_naive>;
+
+// Switch to searching for a set of bytes.  The first two bytes of the set
+// are used as the needle, so test() and time() plant them in their inputs,
+// and test() checks against search_set_naive.  Set count to zero to go back
+// to searching for single bytes.
+void use_set(const char* bytes, int count) {
+  if (count == 0) {
+    reference = with_needle<search_naive>;
+    return;
+  }
+  byte_set = ByteSet(bytes, count);
+  set_needles.clear();
+  for (int i = 0; i < count; i++) set_needles.push_back(Needle(bytes[i]));
+  use_needle(bytes[0], bytes[1]);
+  reference = with_set<search_set_naive>;
+}
+
+// Read the time stamp counter.  The fences keep the loads and calls of the
+// timed loop from being reordered around the reads.  The counter ticks at
+// the nominal frequency of the CPU, so with turbo or power saving these are
+// not quite core cycles, but they are the same for every kernel.
+static inline uint64_t start_cycles() {
+  _mm_lfence();
+  uint64_t cycles = __rdtsc();
+  _mm_lfence();
+  return cycles;
+}
+
+static inline uint64_t end_cycles() {
+  unsigned cpu;
+  uint64_t cycles = __rdtscp(&cpu);
+  _mm_lfence();
+  return cycles;
+}
+
+// Pin the thread to the CPU it is running on, so the time stamp counter
+// and the caches stay the same during a measurement.  Returns the CPUs the
+// thread could run on before, for unpin().
+static cpu_set_t pin() {
+  cpu_set_t before, one;
+  sched_getaffinity(0, sizeof(before), &before);
+  CPU_ZERO(&one);
+  CPU_SET(sched_getcpu(), &one);
+  sched_setaffinity(0, sizeof(one), &one);
+  return before;
+}
+
+static void unpin(const cpu_set_t& before) {
+  sched_setaffinity(0, sizeof(before), &before);
+}
+
+// Hardware performance counters, which time() reads if the harness is run
+// with --counters, to show why one kernel is faster than another.  They are
+// opened as one group, so they all count over the same instructions.  If
+// the group has to share the hardware with other users it only counts some
+// of the time, and the counts are scaled up to the time it was enabled.
+enum Counter { CYCLES, INSTRUCTIONS, BRANCH_MISSES, L1D_MISSES, UOPS, COUNTERS };
+static const char* counter_names[] = {"cycles", "instructions", "branch-misses", "L1D misses", "uops"};
+static bool use_counters = false;
+static int counter_leader = -1;
+// Where each counter is in a read of the group, or -1 if it didn't open.
+static int counter_index[COUNTERS];
+static int counters_open = 0;
+
+// The counts from the runs of a kernel, with the nanoseconds the group was
+// enabled and running for.
+struct CounterTotals {
+  uint64_t counts[COUNTERS];
+  uint64_t enabled;
+  uint64_t running;
+};
+
+static int open_counter(uint32_t type, uint64_t config, int group) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = type;
+  attr.config = config;
+  attr.disabled = group < 0;  // The others follow the leader.
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  return syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+// Returns false, after saying why, if there are no counters, for example in
+// a virtual machine or if perf_event_paranoid is too high.  Counters other
+// than cycles that don't open are left out.
+static bool open_counters() {
+  static const struct {
+    uint32_t type;
+    uint64_t config;
+  } events[] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                         (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+    // There is no generic event for uops.  This is UOPS_ISSUED.ANY on Intel.
+    {PERF_TYPE_RAW, 0x010e},
+  };
+  for (int c = 0; c < COUNTERS; c++) {
+    counter_index[c] = -1;
+    if (c == UOPS && !__builtin_cpu_is("intel")) continue;
+    int fd = open_counter(events[c].type, events[c].config, counter_leader);
+    if (fd < 0) {
+      fprintf(stderr, "Can't count %s: %s\n", counter_names[c], strerror(errno));
+      if (c == CYCLES) return false;
+      continue;
+    }
+    if (c == CYCLES) counter_leader = fd;
+    counter_index[c] = counters_open++;
+  }
+  return true;
+}
+
+static void start_counters() {
+  ioctl(counter_leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+  ioctl(counter_leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+// Stop the counters and add them to totals.
+static void stop_counters(CounterTotals* totals) {
+  ioctl(counter_leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+  struct {
+    uint64_t count;
+    uint64_t enabled;
+    uint64_t running;
+    uint64_t values[COUNTERS];
+  } group;
+  if (read(counter_leader, &group, sizeof(group)) <= 0) return;
+  totals->enabled += group.enabled;
+  totals->running += group.running;
+  for (int c = 0; c < COUNTERS; c++) {
+    if (counter_index[c] >= 0) totals->counts[c] += group.values[counter_index[c]];
+  }
+}
+
+// Print the IPC and the other counters per call, or n/a for the ones that
+// didn't open.  They are all n/a if the group never got the hardware, and
+// say how much of the time they were counted for if it wasn't all of it.
+static void print_counters(const CounterTotals& totals, long long calls) {
+  if (totals.running == 0) {
+    printf("  counters n/a");
+    return;
+  }
+  double scale = (double)totals.enabled / totals.running;
+  if (counter_index[INSTRUCTIONS] < 0 || totals.counts[CYCLES] == 0) {
+    printf("  ipc n/a");
+  } else {
+    printf("  ipc %4.2f", (double)totals.counts[INSTRUCTIONS] / totals.counts[CYCLES]);
+  }
+  for (int c = BRANCH_MISSES; c < COUNTERS; c++) {
+    if (counter_index[c] < 0) {
+      printf("  %s n/a", counter_names[c]);
+    } else {
+      printf("  %s %.3f", counter_names[c], totals.counts[c] * scale / calls);
+    }
+  }
+  if (totals.running < totals.enabled) printf("  (counted %.0f%%)", 100 / scale);
+}
+
+// The names given with --filter.  If there are any, only kernels with one
+// of them in their names are tested and timed.
+static std::vector<const char*> filters;
 
-void time(searcher* fn, const char* name) {
+static bool wanted(const char* name) {
+  if (filters.empty()) return true;
+  for (const char* filter : filters) {
+    if (strstr(name, filter)) return true;
+  }
+  return false;
+}
+
+// Keeps the results of the timed calls, so they are not optimized away.
+static volatile int sink;
+
+// The number of timed runs of each kernel on each input, after a warm-up
+// run, which can be set with --runs.  The median of these is reported,
+// with the minimum and the standard deviation as a percentage of the mean.
+static int runs = 9;
+
+// Search the small or the big input calls times, and return the cycles
+// taken.  Adds the bytes searched up to and including the start of each
+// match to bytes.  The small input is searched from a random offset each
+// time, and the big one from a different alignment.  Normally the calls are
+// independent, so the CPU can start the next one before the last has
+// finished, which measures throughput.  If chained, the offset depends on
+// the result of the search before, as when a lexer starts each search
+// where the last one stopped, which measures latency.
+template<bool chained, typename Search>
+static uint64_t time_calls(Search fn, bool big, int calls, long long* bytes) {
+  int sum = 0;
+  int found = 0;
+  uint64_t start = start_cycles();
+  for (int i = 0; i < calls; i++) {
+    int len;
+    if (big) {
+      int off = (i + (chained ? found : 0)) & 127;
+      len = large_length - off;
+      found = fn(large + off, len);
+    } else {
+      int off = (random_offsets[i & 4095] + (chained ? found : 0)) & 15;
+      len = small_length - off;
+      found = fn(small + off, len);
+    }
+    sum += found;
+    *bytes += found >= 0 ? found + 1 : len;
+  }
+  uint64_t cycles = end_cycles() - start;
+  sink = sum;
+  return cycles;
+}
+
+// Time a kernel on the small and big inputs.  Prints the cycles per call,
+// and per byte, for independent calls, and the cycles per call when each
+// call depends on the one before.  The kernel can be a function pointer, or
+// a lambda, which is compiled into the timing loop.
+template<typename Search>
+void time(Search fn, const char* name) {
+  if (!wanted(name)) return;
+  cpu_set_t before = pin();
   for (int size = 0; size < 2; size++) {
-    struct timeval start, end;
+    int calls = size ? 100000 : 10000000;
+    std::vector<double> per_call(runs);
+    std::vector<double> latency(runs);
+    long long bytes = 0;
+    CounterTotals totals = {};
+    time_calls<false>(fn, size, calls, &bytes);  // Warm-up.
+    bytes = 0;
+    for (int run = 0; run < runs; run++) {
+      if (use_counters) start_counters();
+      per_call[run] = (double)time_calls<false>(fn, size, calls, &bytes) / calls;
+      if (use_counters) stop_counters(&totals);
+    }
+    // A quarter as many calls, since they are slower.
+    long long chained_bytes = 0;
+    for (int run = 0; run < runs; run++) {
+      latency[run] = (double)time_calls<true>(fn, size, calls / 4, &chained_bytes) / (calls / 4);
+    }
+    double mean = 0, variance = 0;
+    for (double c : per_call) mean += c / runs;
+    for (double c : per_call) variance += (c - mean) * (c - mean) / runs;
+    std::sort(per_call.begin(), per_call.end());
+    std::sort(latency.begin(), latency.end());
+    double median = per_call[runs / 2];
+    double bytes_per_call = (double)bytes / calls / runs;
+    printf("(%5s) %17s: %8.2f cycles %7.3f/byte  min %8.2f  sd %4.1f%%  latency %8.2f",
+           size ? "big" : "small", name, median, median / bytes_per_call,
+           per_call[0], 100 * sqrt(variance) / mean, latency[runs / 2]);
+    if (use_counters) print_counters(totals, (long long)calls * runs);
+    printf("\n");
+  }
+  unpin(before);
+}
+
+// A histogram of cycle counts with buckets that are 1/16 of a power of two
+// wide, like an HDR histogram with one significant hex digit, so any count
+// of cycles is recorded to within about 6%.
+struct Histogram {
+  Histogram() : total(0) { memset(counts, 0, sizeof(counts)); }
+
+  static int bucket(uint64_t value) {
+    if (value < 16) return value;
+    int log = 63 - __builtin_clzll(value);
+    return (log - 3) * 16 + ((value >> (log - 4)) & 15);
+  }
+
+  // The highest value that goes in the bucket.
+  static uint64_t highest(int bucket) {
+    if (bucket < 16) return bucket;
+    int log = bucket / 16 + 3;
+    return ((uint64_t)(16 + bucket % 16 + 1) << (log - 4)) - 1;
+  }
+
+  void add(uint64_t value) {
+    counts[bucket(value)]++;
+    total++;
+  }
+
+  // The value that fraction of the samples are at or below.
+  uint64_t percentile(double fraction) const {
+    uint64_t target = (uint64_t)(fraction * total);
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKETS; i++) {
+      seen += counts[i];
+      if (seen > target) return highest(i);
+    }
+    return highest(BUCKETS - 1);
+  }
+
+  static const int BUCKETS = 61 * 16;
+  uint64_t counts[BUCKETS];
+  uint64_t total;
+};
+
+// Remove the input from the caches, so the next search reads it from memory.
+static void flush(const char* s, int len) {
+  for (int i = 0; i < len + 64; i += 64) _mm_clflush(s + i);
+  _mm_mfence();
+}
+
+// Time single calls of a kernel on the small and big inputs, from the same
+// offsets as time(), and print percentiles of the cycles per call.  With
+// cold, the input is flushed from the caches before each call.  The cycles
+// the timing takes with no call are subtracted.
+void time_tails(searcher* fn, const char* name, bool cold) {
+  if (!wanted(name)) return;
+  cpu_set_t before = pin();
+  uint64_t overhead = ~(uint64_t)0;
+  for (int i = 0; i < 1000; i++) {
+    uint64_t start = start_cycles();
+    overhead = std::min(overhead, end_cycles() - start);
+  }
+  for (int size = 0; size < 2; size++) {
+    int samples = size ? 20000 : 200000;
+    Histogram histogram;
     int sum = 0;
-    gettimeofday(&start, 0);
-    int limit = size ? 1000000 : 100000000;
-    for (int i = 0; i < limit; i++) {
+    for (int i = -1000; i < samples; i++) {
+      const char* s;
+      int len;
       if (size) {
-        sum += fn(large + (i & 127), large_length - (i & 127));
+        s = large + (i & 127);
+        len = large_length - (i & 127);
       } else {
         int off = random_offsets[i & 4095] & 15;
-        sum += fn(small + off, small_length - off);
+        s = small + off;
+        len = small_length - off;
+      }
+      if (cold) flush(s, len);
+      uint64_t start = start_cycles();
+      sum += fn(s, len);
+      uint64_t cycles = end_cycles() - start;
+      if (i < 0) continue;  // Warm-up.
+      histogram.add(cycles > overhead ? cycles - overhead : 0);
+    }
+    sink = sum;
+    char label[20];
+    snprintf(label, sizeof(label), "%s %s", size ? "big" : "small", cold ? "cold" : "warm");
+    printf("(%10s) %17s: p50 %6llu  p90 %6llu  p99 %6llu  p99.9 %6llu cycles\n", label, name,
+           (unsigned long long)histogram.percentile(0.5), (unsigned long long)histogram.percentile(0.9),
+           (unsigned long long)histogram.percentile(0.99), (unsigned long long)histogram.percentile(0.999));
+  }
+  unpin(before);
+}
+
+// The workloads for time_distances() have this many buffers, and each call
+// searches the next one, so the match is at a different distance each time.
+static const int BUFFERS = 1024;
+static const int BUFFER_MASK = BUFFERS - 1;
+
+// A histogram of match distances to time with, from --histogram FILE.
+static std::vector<std::pair<int, double> > histogram;
+
+// Read a histogram from a file with a distance and a count on each line.
+static bool load_histogram(const char* file) {
+  FILE* fp = fopen(file, "r");
+  if (!fp) {
+    perror(file);
+    return false;
+  }
+  int distance;
+  double count;
+  while (fscanf(fp, "%d %lf", &distance, &count) == 2) {
+    if (distance >= 0 && distance < (1 << 16) && count > 0) {
+      histogram.push_back(std::make_pair(distance, count));
+    }
+  }
+  fclose(fp);
+  if (histogram.empty()) fprintf(stderr, "%s: No distances\n", file);
+  return !histogram.empty();
+}
+
+enum Distribution { UNIFORM, GEOMETRIC, ZIPF, HISTOGRAM };
+static const char* distribution_names[] = {"uniform", "geometric", "zipf", "histogram"};
+
+// Draw a distance, below 1024 for the built-in distributions: uniform,
+// geometric with a mean of 64, and Zipf with an exponent of 1.
+static int random_distance(Distribution distribution) {
+  static const int LIMIT = 1024;
+  double u = (random() + 0.5) / (RAND_MAX + 1.0);
+  switch (distribution) {
+    case UNIFORM:
+      return random() % LIMIT;
+    case GEOMETRIC: {
+      int distance = log(u) / log(1 - 1.0 / 64);
+      return distance < LIMIT ? distance : random_distance(distribution);
+    }
+    case ZIPF: {
+      static double sums[LIMIT];
+      if (sums[LIMIT - 1] == 0) {
+        for (int i = 0; i < LIMIT; i++) sums[i] = (i ? sums[i - 1] : 0) + 1.0 / (i + 1);
       }
+      return std::lower_bound(sums, sums + LIMIT, u * sums[LIMIT - 1]) - sums;
+    }
+    case HISTOGRAM: {
+      double total = 0;
+      for (auto& bucket : histogram) total += bucket.second;
+      double target = u * total;
+      for (auto& bucket : histogram) {
+        if ((target -= bucket.second) < 0) return bucket.first;
+      }
+      return histogram.back().first;
     }
-    gettimeofday(&end, 0);
-    int ms = (end.tv_sec - start.tv_sec) * 1000;
-    ms += (end.tv_usec - start.tv_usec) / 1000;
-    printf("(%5s) %17s: %5dms %d\n", size ? "big" : "small", name, ms, sum);
   }
+  return 0;
+}
+
+// Buffers of text with the needle at the given distances, each going on for
+// 64 bytes after the needle.  Each buffer starts at a random alignment, or
+// they are all 16-byte aligned.
+struct Workload {
+  Workload(const int* distances, bool random_alignment) {
+    int longest = *std::max_element(distances, distances + BUFFERS) + 64;
+    int stride = (longest + 16 + 63) & ~63;
+    text.resize(stride * BUFFERS + 64);
+    char* base = (char*)(((uintptr_t)text.data() + 63) & ~63);
+    for (int i = 0; i < BUFFERS; i++) {
+      char* s = base + i * stride + (random_alignment ? random() & 15 : 0);
+      lens[i] = distances[i] + 64;
+      for (int j = 0; j < lens[i]; j++) s[j] = "Foo "[j & 3];
+      s[distances[i]] = needle_first;
+      s[distances[i] + 1] = needle_second;
+      starts[i] = s;
+    }
+  }
+  std::vector<char> text;
+  const char* starts[BUFFERS];
+  int lens[BUFFERS];
+};
+
+// The median cycles per call to search each buffer of the workload in
+// turn.  Returns -1 if a search doesn't find the needle at its distance.
+static double time_workload(searcher* fn, const Workload& w, const int* distances) {
+  for (int i = 0; i < BUFFERS; i++) {
+    if (fn(w.starts[i], w.lens[i]) != distances[i]) return -1;
+  }
+  static const int CALLS = 50000;
+  std::vector<double> per_call(runs);
+  for (int run = -1; run < runs; run++) {
+    int sum = 0;
+    uint64_t start = start_cycles();
+    for (int i = 0; i < CALLS; i++) {
+      sum += fn(w.starts[i & BUFFER_MASK], w.lens[i & BUFFER_MASK]);
+    }
+    uint64_t cycles = end_cycles() - start;
+    sink = sum;
+    if (run >= 0) per_call[run] = (double)cycles / CALLS;
+  }
+  std::sort(per_call.begin(), per_call.end());
+  return per_call[runs / 2];
+}
+
+// Time a kernel with the match at a random distance and alignment for each
+// call, from each distribution, and compare it with the match at the same
+// distance, the mean of the random ones, and the same alignment for every
+// call.  The difference is mostly the cost of mispredicting where the loop
+// ends.
+void time_distances(searcher* fn, const char* name) {
+  if (!wanted(name)) return;
+  cpu_set_t before = pin();
+  for (int d = UNIFORM; d <= HISTOGRAM; d++) {
+    if (d == HISTOGRAM && histogram.empty()) continue;
+    srandom(314159);
+    int distances[BUFFERS];
+    double mean = 0;
+    for (int i = 0; i < BUFFERS; i++) {
+      distances[i] = random_distance((Distribution)d);
+      mean += (double)distances[i] / BUFFERS;
+    }
+    int fixed[BUFFERS];
+    for (int i = 0; i < BUFFERS; i++) fixed[i] = (int)(mean + 0.5);
+    Workload random_workload(distances, true);
+    Workload fixed_workload(fixed, false);
+    double random_cycles = time_workload(fn, random_workload, distances);
+    double fixed_cycles = time_workload(fn, fixed_workload, fixed);
+    if (random_cycles < 0 || fixed_cycles < 0) {
+      printf("%s: Wrong result for %s distances\n", name, distribution_names[d]);
+      continue;
+    }
+    printf("(%9s) %17s: %8.2f cycles random, %8.2f at %4.0f  %+6.1f%%\n",
+           distribution_names[d], name, random_cycles, fixed_cycles, mean,
+           100 * (random_cycles - fixed_cycles) / fixed_cycles);
+  }
+  unpin(before);
 }
 
 void test(const char* name, searcher* testee, int bytes) {
+  if (!wanted(name)) return;
   static const int PAGE = 4096;
   char* three_pages = (char*)mmap(NULL, PAGE * 3, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
   mprotect(three_pages, PAGE, PROT_NONE);
@@ -81,9 +711,9 @@ void test(const char* name, searcher* testee, int bytes) {
 
   for (int len = 0; len < 40; len++) {
     memset(start, 'a', len);
-    memset(start + len, '*', 30);
+    memset(start + len, needle_first, 30);
     if (bytes == 2) {
-      for (int k = 1; k < 30; k += 2) start[len + k] = '#';
+      for (int k = 1; k < 30; k += 2) start[len + k] = needle_second;
     }
     int f;
     if ((f = testee(start, len)) != -127) {
@@ -91,15 +721,17 @@ void test(const char* name, searcher* testee, int bytes) {
     }
     for (int pos = 0; pos < len + 1 - bytes; pos++) {
       memset(start, 'a', len);
-      start[pos] = '*';
-      if (bytes == 2) start[pos + 1] = '#';
+      start[pos] = needle_first;
+      if (bytes == 2) start[pos + 1] = needle_second;
       if ((f = testee(start, len)) != pos) {
         printf("%s: Expected at %d, but found at %d\n", name, pos, f);
         printf("len = %d, pos = %d, start=%p\n", len, pos, start);
       }
       if (bytes == 2) {
         for (int k = 0; k < pos; k++) {
-          start[k] = '*';
+          // A doubled byte like "__" really does match one earlier.
+          if (k == pos - 1 && needle_first == needle_second) continue;
+          start[k] = needle_first;
           if ((f = testee(start, len)) != pos) {
             printf("%s: Expected at %d, but found at %d\n", name, pos, f);
             printf("len = %d, pos = %d, start=%p\n", len, pos, start);
@@ -109,19 +741,41 @@ void test(const char* name, searcher* testee, int bytes) {
       }
     }
   }
-  for (int len = 0; len < 40; len++) {
-    memset(end - len, 'a', len);
-    memset(end - len - 30, '*', 30);
-    int f;
-    if ((f = testee(end - len, len)) != -127) {
-      printf("%s: Expected not found, but found at %d\n", name, f);
+  // Strings that end at the guard page, or up to 32 bytes before it with
+  // needles in between, so that a load that crosses into the guard page
+  // faults, and one that stays in the page but doesn't mask the bytes after
+  // the string finds a needle there.  For a pair the gap starts with the
+  // second byte, so a string that ends with the first byte has a match
+  // that straddles its end, which must not be found.
+  for (int gap = 0; gap <= 32; gap++) {
+    char* stop = end - gap;
+    memset(stop, needle_first, gap);
+    if (bytes == 2) {
+      for (int k = 0; k < gap; k += 2) stop[k] = needle_second;
     }
-    for (int pos = 0; pos < len + 1 - bytes; pos++) {
-      memset(end - len, 'a', len);
-      end[-len + pos] = '*';
-      if (bytes == 2) end[-len + pos + 1] = '#';
-      if ((f = testee(end - len, len)) != pos) {
-        printf("%s: Expected at %d, but found at %d\n", name, pos, f);
+    for (int len = 0; len < 40; len++) {
+      memset(stop - len, 'a', len);
+      memset(stop - len - 30, needle_first, 30);
+      int f;
+      if ((f = testee(stop - len, len)) != -127) {
+        printf("%s: Expected not found, but found at %d\n", name, f);
+        printf("len = %d, gap = %d\n", len, gap);
+      }
+      if (bytes == 2 && len > 0) {
+        stop[-1] = needle_first;
+        if ((f = testee(stop - len, len)) != -127) {
+          printf("%s: Expected not found with the first byte last, but found at %d\n", name, f);
+          printf("len = %d, gap = %d\n", len, gap);
+        }
+      }
+      for (int pos = 0; pos < len + 1 - bytes; pos++) {
+        memset(stop - len, 'a', len);
+        stop[-len + pos] = needle_first;
+        if (bytes == 2) stop[-len + pos + 1] = needle_second;
+        if ((f = testee(stop - len, len)) != pos) {
+          printf("%s: Expected at %d, but found at %d\n", name, pos, f);
+          printf("len = %d, gap = %d\n", len, gap);
+        }
       }
     }
   }
@@ -136,63 +790,1093 @@ void test(const char* name, searcher* testee, int bytes) {
       int r = random() & 7;
       switch (r) {
         case 0:
-          buffer[i] = '*';
+          buffer[i] = needle_first;
           break;
         case 1:
-          buffer[i] = '#';
+          buffer[i] = needle_second;
           break;
         case 2:
-          buffer[i] = '*' - 128;
+          buffer[i] = needle_first - 128;
           break;
         case 3:
-          buffer[i] = '#' - 128;
+          buffer[i] = needle_second - 128;
           break;
         case 4:
           buffer[i] = random();
         default:
-          buffer[i] = '#' - 3 + r;
+          buffer[i] = needle_second - 3 + r;
           break;
       }
     }
     char* start = buffer + (random() & 127);
     int len = random() % (buffer + 128 - start);
-    int index = bytes == 2 ? test_twobyte(start, len) : test_naive(start, len);
+    int index = bytes == 2 ? search_twobyte(needle2, start, len) : reference(start, len);
     int guess = testee(start, len);
     if (index != guess) {
       printf("%s: Randomly expected %d, got %d for search length %d in '%s'\n",
           name, index, guess, len, start);
     }
   }
+  free(buffer);
+}
+
+typedef int substring_searcher(const Substring& n, const char* s, int len);
+
+// Like test(), for the substring routines, with needles of every length from
+// 1 to 64.  The needle is planted after a copy of itself with one byte
+// changed, so that there are candidates that fail the full compare.
+void test_substring(const char* name, substring_searcher* testee) {
+  if (!wanted(name)) return;
+  static const int PAGE = 4096;
+  char* three_pages = (char*)mmap(NULL, PAGE * 3, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+  mprotect(three_pages, PAGE, PROT_NONE);
+  mprotect(three_pages + 2 * PAGE, PAGE, PROT_NONE);
+  char* page = three_pages + PAGE;
+
+  char bytes[64];
+  char near[64];
+  for (int length = 1; length <= 64; length++) {
+    for (int i = 0; i < length; i++) bytes[i] = 'b' + (i * 7) % 25;
+    memcpy(near, bytes, length);
+    near[length / 2] = 'a';
+    Substring n(bytes, length);
+    for (int at_end = 0; at_end < 2; at_end++) {
+      for (int len = 0; len < 100; len++) {
+        char* start = at_end ? page + PAGE - len : page;
+        memset(start, 'a', len);
+        int f;
+        if ((f = testee(n, start, len)) != -127) {
+          printf("%s: Expected not found, but found at %d\n", name, f);
+        }
+        // A match that would end just past the end of the string.
+        if (!at_end && len + 1 >= length) {
+          memcpy(start + len + 1 - length, bytes, length);
+          if ((f = testee(n, start, len)) != -127) {
+            printf("%s: Expected not found, but found at %d\n", name, f);
+            printf("length = %d, len = %d, start=%p\n", length, len, start);
+          }
+        }
+        for (int pos = 0; pos <= len - length; pos++) {
+          memset(start, 'a', len);
+          if (pos >= length) memcpy(start + pos - length, near, length);
+          memcpy(start + pos, bytes, length);
+          if ((f = testee(n, start, len)) != pos) {
+            printf("%s: Expected at %d, but found at %d\n", name, pos, f);
+            printf("length = %d, len = %d, pos = %d, start=%p\n", length, len, pos, start);
+          }
+        }
+      }
+    }
+  }
+
+  munmap(three_pages, PAGE * 3);
+
+  // Random tests with a two letter alphabet, so there are lots of partial
+  // matches.
+  char* buffer = (char*)malloc(256);
+  srandom(314159);
+  for (int iterations = 0; iterations < 20000; iterations++) {
+    int length = 1 + (random() & 15);
+    for (int i = 0; i < length; i++) bytes[i] = 'a' + (random() & 1);
+    for (int i = 0; i < 256; i++) buffer[i] = 'a' + (random() & 1);
+    Substring n(bytes, length);
+    char* start = buffer + (random() & 127);
+    int len = random() % (buffer + 256 - start);
+    int index = search_substring_naive(n, start, len);
+    int guess = testee(n, start, len);
+    if (index != guess) {
+      printf("%s: Randomly expected %d, got %d for needle length %d, search length %d\n",
+          name, index, guess, length, len);
+    }
+  }
+  free(buffer);
+}
+
+static std::boyer_moore_horspool_searcher<const char*>* horspool;
+
+int substring_memmem(const Substring& n, const char* s, int len) {
+  const char* found = (const char*)memmem(s, len, n.needle, n.length);
+  return found ? found - s : -127;
+}
+
+// Uses the searcher in horspool, which must have been made for the needle.
+int substring_horspool(const Substring& n, const char* s, int len) {
+  const char* found = std::search(s, s + len, *horspool);
+  return found == s + len ? -127 : found - s;
+}
+
+// Time finding every occurrence of needles of several lengths in 64k of
+// random letters, with the needle planted every spacing bytes, or not at all.
+void time_substring(bool avx2) {
+  static const int SIZE = 65536;
+  static const char script[] = "</script>0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ!";
+  static const int lengths[] = {3, 9, 16, 32, 64};
+  static const int spacings[] = {0, 4096, 64};
+  char* buffer = (char*)malloc(SIZE);
+  static const struct {
+    const char* name;
+    substring_searcher* fn;
+  } kernels[] = {
+    {"memmem", substring_memmem},
+    {"horspool", substring_horspool},
+    {"substring_sse2", search_substring_pure_sse2},
+    {"substring_avx2", search_substring_pure_avx2},
+  };
+  for (int length : lengths) {
+    Substring n(script, length);
+    horspool = new std::boyer_moore_horspool_searcher<const char*>(script, script + length);
+    for (int spacing : spacings) {
+      srandom(314159);
+      for (int i = 0; i < SIZE; i++) buffer[i] = 'a' + random() % 26;
+      if (spacing) {
+        for (int i = spacing - length; i + length <= SIZE; i += spacing) {
+          memcpy(buffer + i, script, length);
+        }
+      }
+      for (auto& k : kernels) {
+        if (k.fn == search_substring_pure_avx2 && !avx2) continue;
+        if (!wanted(k.name)) continue;
+        struct timeval start, end;
+        int count = 0;
+        gettimeofday(&start, 0);
+        for (int i = 0; i < 10000; i++) {
+          int pos = 0;
+          while (true) {
+            int found = k.fn(n, buffer + pos, SIZE - pos);
+            if (found < 0) break;
+            count++;
+            pos += found + 1;
+          }
+        }
+        gettimeofday(&end, 0);
+        int ms = (end.tv_sec - start.tv_sec) * 1000;
+        ms += (end.tv_usec - start.tv_usec) / 1000;
+        char label[20];
+        if (spacing) {
+          snprintf(label, sizeof(label), "%2d/%4d", length, spacing);
+        } else {
+          snprintf(label, sizeof(label), "%2d/none", length);
+        }
+        printf("(%s) %17s: %5dms %d\n", label, k.name, ms, count);
+      }
+    }
+    delete horspool;
+  }
+  free(buffer);
+}
+
+typedef int all_searcher(const char* s, int len, int* positions, int max);
+
+template<int (*fn)(const Needle&, const char*, int, int*, int)>
+int all_with_needle(const char* s, int len, int* positions, int max) {
+  return fn(needle, s, len, positions, max);
+}
+
+template<int (*fn)(const Needle2&, const char*, int, int*, int)>
+int all_with_needle2(const char* s, int len, int* positions, int max) {
+  return fn(needle2, s, len, positions, max);
+}
+
+// Find every match by restarting a search after each one.
+int restart_all(searcher* fn, const char* s, int len, int* positions, int max) {
+  int found = 0;
+  int pos = 0;
+  while (found < max) {
+    int index = fn(s + pos, len - pos);
+    if (index < 0) break;
+    positions[found++] = pos + index;
+    pos += index + 1;
+  }
+  return found;
+}
+
+// Check a find_all_ routine and a count_ routine against restarting the
+// naive search, on random strings that are mostly the needle bytes, at both
+// ends of a guarded page, and with the positions buffer too small.
+void test_find_all(const char* name, all_searcher* finder, searcher* counter, int bytes) {
+  if (!wanted(name)) return;
+  static const int PAGE = 4096;
+  char* three_pages = (char*)mmap(NULL, PAGE * 3, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+  mprotect(three_pages, PAGE, PROT_NONE);
+  mprotect(three_pages + 2 * PAGE, PAGE, PROT_NONE);
+  char* page = three_pages + PAGE;
+  searcher* naive = bytes == 2 ? with_needle2<search_twobyte> : with_needle<search_naive>;
+
+  static int expected[PAGE];
+  static int positions[PAGE];
+  srandom(314159);
+  for (int iterations = 0; iterations < 4000; iterations++) {
+    int len = random() % 100;
+    char* start = (iterations & 1) ? page + PAGE - len : page + (random() & 63);
+    for (int i = 0; i < len; i++) {
+      int r = random() & 3;
+      start[i] = r == 0 ? 'a' : r == 1 ? needle_second : needle_first;
+    }
+    int count = restart_all(naive, start, len, expected, PAGE);
+    int found = finder(start, len, positions, PAGE);
+    if (found != count || memcmp(positions, expected, count * sizeof(int)) != 0) {
+      printf("%s: Expected %d matches, found %d, for search length %d\n", name, count, found, len);
+    }
+    if ((found = finder(start, len, positions, count / 2)) != count / 2 ||
+        memcmp(positions, expected, count / 2 * sizeof(int)) != 0) {
+      printf("%s: Expected %d matches with a short buffer, found %d\n", name, count / 2, found);
+    }
+    if ((found = counter(start, len)) != count) {
+      printf("%s: Expected a count of %d, got %d for search length %d\n", name, count, found, len);
+    }
+  }
+
+  munmap(three_pages, PAGE * 3);
+}
+
+// Time finding every match in 64k of text, with the needle planted every
+// spacing bytes, by restarting the search after each match and with the
+// find_all_ and count_ routines.
+void time_find_all(bool avx2) {
+  static const int SIZE = 65536;
+  static int positions[SIZE];
+  char* buffer = (char*)malloc(SIZE);
+  static const struct {
+    const char* name;
+    searcher* restart;
+    all_searcher* finder;
+    searcher* counter;
+    bool avx2;
+  } kernels[] = {
+    {"pure_sse2", with_needle<search_pure_sse2>, 0, 0, false},
+    {"find_all_sse2", 0, all_with_needle<find_all_pure_sse2>, 0, false},
+    {"find_all_avx2", 0, all_with_needle<find_all_pure_avx2>, 0, true},
+    {"count_sse2", 0, 0, with_needle<count_pure_sse2>, false},
+    {"count_avx2", 0, 0, with_needle<count_pure_avx2>, true},
+    {"pure_twobsse2", with_needle2<search_pure_twobsse2>, 0, 0, false},
+    {"find_all_twobsse2", 0, all_with_needle2<find_all_pure_twobsse2>, 0, false},
+    {"find_all_twobavx2", 0, all_with_needle2<find_all_pure_twobavx2>, 0, true},
+    {"count_twobsse2", 0, 0, with_needle2<count_pure_twobsse2>, false},
+    {"count_twobavx2", 0, 0, with_needle2<count_pure_twobavx2>, true},
+  };
+  for (int spacing = 4096; spacing >= 4; spacing /= 4) {
+    for (int i = 0; i < SIZE; i += 4) memcpy(buffer + i, "Foo ", 4);
+    for (int i = spacing / 2; i < SIZE - 1; i += spacing) {
+      buffer[i] = '*';
+      buffer[i + 1] = '#';
+    }
+    for (auto& k : kernels) {
+      if ((k.avx2 && !avx2) || !wanted(k.name)) continue;
+      struct timeval start, end;
+      int sum = 0;
+      gettimeofday(&start, 0);
+      for (int i = 0; i < 20000; i++) {
+        if (k.restart) {
+          sum += restart_all(k.restart, buffer, SIZE, positions, SIZE);
+        } else if (k.finder) {
+          sum += k.finder(buffer, SIZE, positions, SIZE);
+        } else {
+          sum += k.counter(buffer, SIZE);
+        }
+      }
+      gettimeofday(&end, 0);
+      int ms = (end.tv_sec - start.tv_sec) * 1000;
+      ms += (end.tv_usec - start.tv_usec) / 1000;
+      printf("(1/%4d) %17s: %5dms %d\n", spacing, k.name, ms, sum);
+    }
+  }
+  free(buffer);
+}
+
+typedef int stream_searcher(const Needle2& n, StreamState* state, const char* s, int len);
+
+// Feed a copy of the large input, with extra needles planted at random
+// places, to a stream routine in random sized pieces, and check that it
+// finds the same matches as restarting the naive search on the whole thing.
+// Every other piece boundary splits a needle.
+void test_stream(const char* name, stream_searcher* testee) {
+  if (!wanted(name)) return;
+  char* buffer = (char*)malloc(large_length);
+  static int expected[10000];
+  static int positions[10000];
+  srandom(314159);
+  for (int iterations = 0; iterations < 200; iterations++) {
+    memcpy(buffer, large, large_length);
+    for (int i = 0; i < 50; i++) {
+      int at = random() % (large_length - 1);
+      buffer[at] = needle_first;
+      buffer[at + 1] = needle_second;
+    }
+    int pieces[1000];
+    int piece_count = 0;
+    for (int at = 0; at < large_length; ) {
+      int size = random() % 100;
+      if (at + size > large_length) size = large_length - at;
+      pieces[piece_count++] = size;
+      at += size;
+      if ((piece_count & 1) && at > 0 && at < large_length) {
+        buffer[at - 1] = needle_first;
+        buffer[at] = needle_second;
+      }
+    }
+    int count = restart_all(with_needle2<search_twobyte>, buffer, large_length, expected, 10000);
+    int found = 0;
+    StreamState state;
+    int start = 0;
+    for (int p = 0; p < piece_count; p++) {
+      int pos = 0;
+      int size = pieces[p];
+      while (true) {
+        int index = testee(needle2, &state, buffer + start + pos, size - pos);
+        if (index == -127) break;
+        if (found < 10000) positions[found] = start + pos + index;
+        found++;
+        pos += index + 1;
+      }
+      start += size;
+    }
+    if (found != count || memcmp(positions, expected, count * sizeof(int)) != 0) {
+      printf("%s: Expected %d matches, found %d, in %d pieces\n", name, count, found, piece_count);
+    }
+  }
+  free(buffer);
+}
+
+// Check a pool against the naive search on a megabyte of text with a few
+// needles planted, some of them across chunk boundaries, for a few thread
+// counts and chunk sizes, and at each alignment of the start.
+void test_parallel() {
+  if (!wanted("parallel")) return;
+  static const int SIZE = 1 << 20;
+  char* buffer = (char*)malloc(SIZE + 64);
+  searcher* naive1 = with_needle<search_naive>;
+  searcher* naive2 = with_needle2<search_twobyte>;
+  srandom(314159);
+  for (int threads = 1; threads <= 4; threads *= 2) {
+    for (int chunk_size = 64; chunk_size <= 65536; chunk_size *= 32) {
+      SearchPool pool(threads, chunk_size);
+      for (int iterations = 0; iterations < 100; iterations++) {
+        char* s = buffer + (iterations & 63);
+        int len = SIZE - random() % 1000;
+        for (int i = 0; i < len; i += 4) memcpy(s + i, "Foo ", len - i < 4 ? len - i : 4);
+        // The first needle byte before the end of a chunk, and a second one
+        // that does not follow it.
+        int line = (64 - ((uintptr_t)s & 63)) & 63;
+        for (int i = random() % 4; i > 0; i--) {
+          int at = random() % (len - 1);
+          int boundary = line + (at - line) / chunk_size * chunk_size;
+          if (boundary > 0 && boundary < len) at = boundary - 1;
+          s[at] = needle_first;
+          s[at + 1] = needle_second;
+        }
+        if (iterations & 1) s[random() % len] = needle_second;
+        long long expected = naive1(s, len);
+        long long found = pool.search_byte(needle, s, len);
+        if (found != expected) {
+          printf("parallel byte, %d threads: Expected %lld, found %lld\n", threads, expected, found);
+        }
+        expected = naive2(s, len);
+        found = pool.search_pair(needle2, s, len);
+        if (found != expected) {
+          printf("parallel pair, %d threads: Expected %lld, found %lld\n", threads, expected, found);
+        }
+      }
+    }
+  }
+  free(buffer);
+}
+
+// Time a search of 256M of text with the needle near the end, on one thread
+// with search_byte and search_pair, and with a pool of 1 to N threads.
+void time_parallel() {
+  if (!wanted("parallel")) return;
+  static const int SIZE = 1 << 28;
+  char* buffer = (char*)malloc(SIZE);
+  for (int i = 0; i < SIZE; i += 4) memcpy(buffer + i, "Foo ", 4);
+  int at = SIZE - SIZE / 16;
+  buffer[at] = needle_first;
+  buffer[at + 1] = needle_second;
+  int cpus = std::thread::hardware_concurrency();
+  // Thread count 0 is the single-threaded search.  The counts double, and
+  // the last is the number of CPUs.
+  for (int threads = 0; threads <= cpus; threads = threads == 0 ? 1 : threads < cpus && threads * 2 > cpus ? cpus : threads * 2) {
+    SearchPool pool(threads ? threads : 1);
+    for (int bytes = 1; bytes <= 2; bytes++) {
+      struct timeval start, end;
+      long long sum = 0;
+      gettimeofday(&start, 0);
+      for (int i = 0; i < 20; i++) {
+        if (threads == 0) {
+          sum += bytes == 1 ? search_byte(needle, buffer, SIZE) : search_pair(needle2, buffer, SIZE);
+        } else {
+          sum += bytes == 1 ? pool.search_byte(needle, buffer, SIZE) : pool.search_pair(needle2, buffer, SIZE);
+        }
+      }
+      gettimeofday(&end, 0);
+      int ms = (end.tv_sec - start.tv_sec) * 1000;
+      ms += (end.tv_usec - start.tv_usec) / 1000;
+      char name[40];
+      if (threads == 0) {
+        snprintf(name, sizeof(name), "%s", bytes == 1 ? "search_byte" : "search_pair");
+      } else {
+        snprintf(name, sizeof(name), "pool %s %d", bytes == 1 ? "byte" : "pair", threads);
+      }
+      printf("( 256M) %17s: %5dms %lld\n", name, ms, sum);
+    }
+  }
+  free(buffer);
+}
+
+// Check a routine that needs a null byte after the string against the naive
+// search, on random strings that are mostly the needle bytes.
+void test_terminated(const char* name, searcher* testee, int bytes) {
+  if (!wanted(name)) return;
+  char buffer[101];
+  srandom(314159);
+  for (int iterations = 0; iterations < 10000; iterations++) {
+    int len = random() % 101;
+    for (int i = 0; i < len; i++) {
+      int r = random() & 3;
+      buffer[i] = r == 0 ? 'a' : r == 1 ? needle_second : needle_first;
+    }
+    buffer[len] = '\0';
+    int index = bytes == 2 ? search_twobyte(needle2, buffer, len) : search_naive(needle, buffer, len);
+    int guess = testee(buffer, len);
+    if (index != guess) {
+      printf("%s: Randomly expected %d, got %d for search length %d\n", name, index, guess, len);
+    }
+  }
+}
+
+// Check a routine that must not read outside the string on copies of
+// strings up to 100 bytes in buffers of exactly their length, with needles
+// in the bytes before and after them.  Under AddressSanitizer a read
+// outside the buffer is reported, and otherwise it may find a needle.
+void test_exact(const char* name, searcher* testee, int bytes) {
+  if (!wanted(name)) return;
+  char text[100 + 128];
+  for (int len = 0; len <= 100; len++) {
+    for (int pos = -1; pos < len + 1 - bytes; pos++) {
+      for (int i = 0; i < len + 128; i++) {
+        text[i] = bytes == 2 && (i & 1) ? needle_second : needle_first;
+      }
+      memset(text + 64, 'a', len);
+      if (pos >= 0) {
+        text[64 + pos] = needle_first;
+        if (bytes == 2) text[64 + pos + 1] = needle_second;
+      }
+      char* copy = (char*)malloc(len);
+      memcpy(copy, text + 64, len);
+      int f = testee(copy, len);
+      if (f != (pos >= 0 ? pos : -127)) {
+        printf("%s: Expected at %d, but found at %d\n", name, pos, f);
+        printf("len = %d\n", len);
+      }
+      // In place, where reading outside the string finds a needle.
+      if ((f = testee(text + 64, len)) != (pos >= 0 ? pos : -127)) {
+        printf("%s: Expected at %d, but found at %d between needles\n", name, pos, f);
+        printf("len = %d\n", len);
+      }
+      free(copy);
+    }
+  }
+}
+
+// Check a routine that may read 64 bytes either side of the string, on
+// strings of each length and alignment up to 100 bytes, in a buffer that
+// has 64 bytes of needles either side and unmapped pages after that.  A
+// kernel that reads further faults, and one that doesn't mask the bytes
+// after the string finds a needle there.
+void test_padded(const char* name, searcher* testee, int bytes) {
+  if (!wanted(name)) return;
+  static const int PAGE = 4096;
+  char* three_pages = (char*)mmap(NULL, PAGE * 3, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+  mprotect(three_pages, PAGE, PROT_NONE);
+  mprotect(three_pages + 2 * PAGE, PAGE, PROT_NONE);
+  char* page = three_pages + PAGE;
+  for (int len = 0; len <= 100; len++) {
+    // At each alignment 64 bytes or more into the page, and ending 64 bytes
+    // before the end of it.
+    for (int alignment = 0; alignment <= 64; alignment++) {
+      char* start = alignment == 64 ? page + PAGE - 64 - len : page + 64 + alignment;
+      for (int i = -64; i < len + 64; i++) {
+        start[i] = bytes == 2 && (i & 1) ? needle_second : needle_first;
+      }
+      memset(start, 'a', len);
+      int f;
+      if ((f = testee(start, len)) != -127) {
+        printf("%s: Expected not found, but found at %d\n", name, f);
+        printf("len = %d, alignment = %d\n", len, alignment);
+      }
+      for (int pos = 0; pos < len + 1 - bytes; pos++) {
+        start[pos] = needle_first;
+        if (bytes == 2) start[pos + 1] = needle_second;
+        if ((f = testee(start, len)) != pos) {
+          printf("%s: Expected at %d, but found at %d\n", name, pos, f);
+          printf("len = %d, alignment = %d\n", len, alignment);
+        }
+        memset(start + pos, 'a', bytes);
+      }
+    }
+  }
+  munmap(three_pages, PAGE * 3);
+}
+
+// The kernels in inline.h compiled into the timing loop, so there is no
+// call and the patterns are loaded once, against the same kernels called
+// out of line, for the current needle.  The AVX2 ones are not timed, since
+// the harness is not compiled for AVX2, so they would not be inlined.
+void time_inline() {
+  const Needle n = needle;
+  const Needle2 n2 = needle2;
+  time([n](const char* s, int len) { return search_pure_mycroft(n, s, len); }, "call pure_mycroft");
+  time([n](const char* s, int len) { return inline_pure_mycroft(n, s, len); }, "inline pure_mycroft");
+  time([n](const char* s, int len) { return search_pure_sse2(n, s, len); }, "call pure_sse2");
+  time([n](const char* s, int len) { return inline_pure_sse2(n, s, len); }, "inline pure_sse2");
+  time([n2](const char* s, int len) { return search_pure_mycroft2(n2, s, len); }, "call pure_mycroft2");
+  time([n2](const char* s, int len) { return inline_pure_mycroft2(n2, s, len); }, "inline pure_mycroft2");
+  time([n2](const char* s, int len) { return search_pure_twobsse2(n2, s, len); }, "call pure_twobsse2");
+  time([n2](const char* s, int len) { return inline_pure_twobsse2(n2, s, len); }, "inline pure_twobsse2");
 }
 
-int main() {
+struct Kernel {
+  const char* name;
+  searcher* fn;
+  int bytes;
+  const KernelInfo* info;  // For the registered kernels.
+};
+
+// The registered kernels that the CPU can run and that match the filters,
+// found by find_kernels().  The fixed ones are the test_ routines, which
+// look for '*' and "*#", and the needle ones call their search_ routines
+// directly for the needle given at runtime.  The padded ones are test_
+// routines that must only be called on strings with padding either side.
+static std::vector<Kernel> fixed_kernels;
+static std::vector<Kernel> needle_kernels;
+static std::vector<Kernel> padded_kernels;
+
+static void find_kernels() {
+  for (const KernelInfo* info = KernelInfo::first; info; info = info->next) {
+    if (!info->supported() || !wanted(info->name)) continue;
+    if (info->over_read == PADDED) {
+      padded_kernels.push_back({info->name, info->fixed, info->bytes, info});
+    } else if (info->fixed) {
+      fixed_kernels.push_back({info->name, info->fixed, info->bytes, info});
+    } else {
+      needle_kernels.push_back({info->name, info->direct, info->bytes, info});
+    }
+  }
+}
+
+// The C and C++ library routines for the same needle.
+static const Kernel baseline_kernels[] = {
+  {"memchr", libc_memchr, 1},
+  {"string_view_find", string_view_find, 1},
+  {"std_find", std_find, 1},
+  {"memmem", libc_memmem, 2},
+  {"string_view_find2", string_view_find2, 2},
+  {"boyer_moore", std_search_boyer_moore, 2},
+  {"horspool", std_search_horspool, 2},
+};
+
+// The ones that need a null byte after the string, and no others.  The
+// sentinel kernels only look for "*" and "*#".
+static const Kernel terminated_kernels[] = {
+  {"strchr", libc_strchr, 1},
+  {"strstr", libc_strstr, 2},
+  {"sentinel_sse2", sentinel_byte, 1},
+  {"sentinel_twobsse2", sentinel_pair, 2},
+};
+
+// Test or time a kernel for the current needle, which is added to its name.
+void run(const Kernel& k, bool timing) {
+  char name[40];
+  if (k.bytes == 1) {
+    snprintf(name, sizeof(name), "%s %02x", k.name, (uint8_t)needle_first);
+  } else {
+    snprintf(name, sizeof(name), "%s %02x%02x", k.name,
+             (uint8_t)needle_first, (uint8_t)needle_second);
+  }
+  if (timing) {
+    time(k.fn, name);
+  } else {
+    test(name, k.fn, k.bytes);
+  }
+}
+
+template<char C1, char C2>
+void constant_kernels(bool timing) {
+  use_needle(C1, C2);
+  static const Kernel kernels[] = {
+    {"const_mycroft", constant_mycroft<C1>, 1},
+    {"const_pure_mycroft", constant_pure_mycroft<C1>, 1},
+    {"const_sse2", constant_sse2<C1>, 1},
+    {"const_pure_sse2", constant_pure_sse2<C1>, 1},
+    {"const_mycroft2", constant_mycroft2<C1, C2>, 2},
+    {"const_pure_mycroft2", constant_pure_mycroft2<C1, C2>, 2},
+    {"const_twosse2", constant_twosse2<C1, C2>, 2},
+    {"const_pure_twobsse2", constant_pure_twobsse2<C1, C2>, 2},
+  };
+  for (auto& k : kernels) run(k, timing);
+}
+
+// Where sweep() plants the needle.
+enum Position { NONE, FIRST, MIDDLE, LAST };
+static const char* position_names[] = {"none", "first", "middle", "last"};
+
+// The runs of each measurement in sweep(), of which the median is reported.
+static const int SWEEP_RUNS = 3;
+
+// Time every kernel for the '*#' needle on text of each power of two length
+// from 1 byte to max_length, with the needle at each Position, starting at
+// each alignment from 0 to 63 in steps of align_step.  Each measurement does
+// enough calls to search about a megabyte.  Writes a CSV line or a JSON
+// object for each measurement, with the median cycles per call and per byte
+// searched up to and including the match.
+void sweep(bool json, int max_length, int align_step) {
+  use_needle('*', '#');
+  std::vector<Kernel> kernels(needle_kernels);
+  // The registered test_ kernels have the same names as the search_ ones,
+  // so they are written with a test_ prefix.
+  std::vector<std::string> test_names;
+  for (auto& k : fixed_kernels) test_names.push_back(std::string("test_") + k.name);
+  for (size_t i = 0; i < fixed_kernels.size(); i++) {
+    kernels.push_back(fixed_kernels[i]);
+    kernels.back().name = test_names[i].c_str();
+  }
+  for (auto& k : baseline_kernels) {
+    if (wanted(k.name)) kernels.push_back(k);
+  }
+  for (auto& k : terminated_kernels) {
+    if (wanted(k.name)) kernels.push_back(k);
+  }
+  // aligned_alloc needs a multiple of the alignment.
+  size_t size = ((size_t)max_length + 128 + 63) & ~(size_t)63;
+  char* buffer = (char*)aligned_alloc(64, size);
+  for (size_t i = 0; i < size; i += 4) memcpy(buffer + i, "Foo ", 4);
+  cpu_set_t before = pin();
+  if (json) {
+    printf("[\n");
+  } else {
+    printf("kernel,bytes,length,position,alignment,found,cycles,cycles_per_byte\n");
+  }
+  bool first_line = true;
+  for (int len = 1; len <= max_length; len *= 2) {
+    int calls = std::max(1, std::min(100000, (1 << 20) / len));
+    for (int position = NONE; position <= LAST; position++) {
+      for (int alignment = 0; alignment < 64; alignment += align_step) {
+        char* s = buffer + 64 + alignment;
+        char after = s[len];
+        s[len] = '\0';  // For strchr and strstr.
+        for (const Kernel& k : kernels) {
+          if (position != NONE && len < k.bytes) continue;
+          int at = position == FIRST ? 0 : position == MIDDLE ? (len - k.bytes) / 2 : len - k.bytes;
+          int expected = position == NONE ? -127 : at;
+          if (position != NONE) {
+            s[at] = needle_first;
+            if (k.bytes == 2) s[at + 1] = needle_second;
+          }
+          double per_call[SWEEP_RUNS];
+          int found = 0;
+          for (int run = -1; run < SWEEP_RUNS; run++) {
+            uint64_t start = start_cycles();
+            for (int i = 0; i < calls; i++) found = k.fn(s, len);
+            uint64_t cycles = end_cycles() - start;
+            if (run >= 0) per_call[run] = (double)cycles / calls;
+          }
+          // Put the text back.
+          if (position != NONE) {
+            for (int i = at; i < at + k.bytes; i++) s[i] = "Foo "[(s + i - buffer) & 3];
+          }
+          if (found != expected) {
+            fprintf(stderr, "%s: Expected %d, found %d for length %d\n", k.name, expected, found, len);
+          }
+          std::sort(per_call, per_call + SWEEP_RUNS);
+          double cycles = per_call[SWEEP_RUNS / 2];
+          int searched = found >= 0 ? found + 1 : len;
+          if (json) {
+            printf("%s  {\"kernel\": \"%s\", \"bytes\": %d, \"length\": %d, \"position\": \"%s\", "
+                   "\"alignment\": %d, \"found\": %d, \"cycles\": %.2f, \"cycles_per_byte\": %.4f}",
+                   first_line ? "" : ",\n", k.name, k.bytes, len, position_names[position],
+                   alignment, found, cycles, cycles / searched);
+          } else {
+            printf("%s,%d,%d,%s,%d,%d,%.2f,%.4f\n", k.name, k.bytes, len, position_names[position],
+                   alignment, found, cycles, cycles / searched);
+          }
+          first_line = false;
+        }
+        s[len] = after;
+      }
+    }
+  }
+  if (json) printf("\n]\n");
+  unpin(before);
+  free(buffer);
+}
+
+// The percentiles of single calls of the registered test_ kernels, with
+// the input in the caches and flushed from them.
+void tails() {
+  for (int cold = 0; cold < 2; cold++) {
+    for (auto& k : fixed_kernels) time_tails(k.fn, k.name, cold);
+  }
+}
+
+static double seconds() {
+  struct timeval tv;
+  gettimeofday(&tv, 0);
+  return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+// Search buffers from 4K to four times the size of the L3 cache, with no
+// match, so every byte is read, and print the GB/s for each kernel.  Each
+// size is searched repeatedly until 256M has been read.  The percentage is
+// of the bandwidth of memcpy on the same size, counting the bytes it reads
+// and writes, as STREAM does for its copy.
+void bandwidth() {
+  use_needle('*', '#');
+  long l3 = sysconf(_SC_LEVEL3_CACHE_SIZE);
+  if (l3 <= 0) l3 = 32 << 20;
+  int largest = 4096;
+  while (largest < 4 * l3 && largest < (1 << 30)) largest *= 2;
+  char* buffer = (char*)aligned_alloc(64, largest);
+  char* copy = (char*)aligned_alloc(64, largest);
+  for (int i = 0; i < largest; i += 4) memcpy(buffer + i, "Foo ", 4);
+  memset(copy, 0, largest);
+  cpu_set_t before = pin();
+  for (int size = 4096; size <= largest; size *= 2) {
+    int reps = std::max(1, (1 << 28) / size);
+    char label[8];
+    if (size < (1 << 20)) {
+      snprintf(label, sizeof(label), "%dK", size >> 10);
+    } else {
+      snprintf(label, sizeof(label), "%dM", size >> 20);
+    }
+    memcpy(copy, buffer, size);
+    double start = seconds();
+    for (int i = 0; i < reps; i++) memcpy(copy, buffer, size);
+    double copy_rate = 2.0 * size * reps / (seconds() - start) / 1e9;
+    sink = copy[size - 1];
+    printf("(%5s) %17s: %6.2f GB/s\n", label, "memcpy", copy_rate);
+    for (const Kernel& k : needle_kernels) {
+      int sum = k.fn(buffer, size);
+      start = seconds();
+      for (int i = 0; i < reps; i++) sum += k.fn(buffer, size);
+      double rate = (double)size * reps / (seconds() - start) / 1e9;
+      sink = sum;
+      printf("(%5s) %17s: %6.2f GB/s %4.0f%%\n", label, k.name, rate, 100 * rate / copy_rate);
+    }
+  }
+  unpin(before);
+  free(buffer);
+  free(copy);
+}
+
+// What one thread of scaling() did: the bytes it searched up to and
+// including the start of each match, the seconds it took, and the sum of
+// the results, for sink.
+struct ThreadResult {
+  long long bytes;
+  double seconds;
+  int sum;
+};
+
+// Search a private copy of the big input from one thread of scaling().
+// Waits until all the threads are ready, so they run together.
+static ThreadResult search_copy(searcher* fn, int cpu, std::atomic<int>* waiting) {
+  if (cpu >= 0) {
+    cpu_set_t one;
+    CPU_ZERO(&one);
+    CPU_SET(cpu, &one);
+    sched_setaffinity(0, sizeof(one), &one);
+  }
+  // aligned_alloc needs a multiple of the alignment.
+  char* copy = (char*)aligned_alloc(64, (large_length + 128 + 63) & ~63);
+  memcpy(copy, large, large_length);
+  ThreadResult result = {0, 0, 0};
+  waiting->fetch_sub(1);
+  while (waiting->load() > 0) std::this_thread::yield();
+  double start = seconds();
+  for (int i = 0; i < 200000; i++) {
+    int found = fn(copy + (i & 127), large_length - (i & 127));
+    result.sum += found;
+    result.bytes += found >= 0 ? found + 1 : large_length - (i & 127);
+  }
+  result.seconds = seconds() - start;
+  free(copy);
+  return result;
+}
+
+// Run each kernel on 1 to all of the hardware threads at once, each thread
+// searching its own copy of the big input, and print the total GB/s and
+// the slowest and fastest thread's GB/s, each timed by the thread itself.
+// Pinned, thread i runs on the i'th CPU this process may use, so with more
+// threads than cores some share a core with SMT.  Unpinned, the threads go
+// where the scheduler puts them.
+void scaling() {
+  cpu_set_t allowed;
+  sched_getaffinity(0, sizeof(allowed), &allowed);
+  std::vector<int> cpus;
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (CPU_ISSET(cpu, &allowed)) cpus.push_back(cpu);
+  }
+  int most = cpus.size();
+  for (auto& k : fixed_kernels) {
+    for (int threads = 1; threads <= most; threads = threads < most && threads * 2 > most ? most : threads * 2) {
+      for (int pinned = 0; pinned < 2; pinned++) {
+        std::atomic<int> waiting(threads);
+        std::vector<std::thread> workers;
+        std::vector<ThreadResult> results(threads);
+        for (int i = 0; i < threads; i++) {
+          workers.push_back(std::thread([&, i] {
+            results[i] = search_copy(k.fn, pinned ? cpus[i] : -1, &waiting);
+          }));
+        }
+        while (waiting.load() > 0) std::this_thread::yield();
+        double start = seconds();
+        for (auto& worker : workers) worker.join();
+        double elapsed = seconds() - start;
+        long long total = 0;
+        int sum = 0;
+        double slowest = 1e30, fastest = 0;
+        for (auto& result : results) {
+          total += result.bytes;
+          sum += result.sum;
+          double rate = result.bytes / result.seconds / 1e9;
+          slowest = std::min(slowest, rate);
+          fastest = std::max(fastest, rate);
+        }
+        sink = sum;
+        char label[20];
+        snprintf(label, sizeof(label), "%d %s", threads, pinned ? "pinned" : "free");
+        printf("(%9s) %17s: %6.2f GB/s, %6.2f to %6.2f GB/s per thread\n",
+               label, k.name, total / elapsed / 1e9, slowest, fastest);
+      }
+    }
+  }
+}
+
+static void usage() {
+  fprintf(stderr, "Usage: search [--filter NAME]... [--runs N] [--counters] [--histogram FILE] [--tails] [--bandwidth] [--threads] [--sweep [--json] [--max-length BYTES] [--align-step N]]\n");
+  exit(2);
+}
+
+int main(int argc, char** argv) {
+  bool sweeping = false;
+  bool tailing = false;
+  bool measuring_bandwidth = false;
+  bool threading = false;
+  bool json = false;
+  int max_length = 64 << 20;
+  int align_step = 1;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--counters") == 0) {
+      use_counters = open_counters();
+    } else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+      filters.push_back(argv[++i]);
+    } else if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc) {
+      runs = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--histogram") == 0 && i + 1 < argc) {
+      if (!load_histogram(argv[++i])) return 2;
+    } else if (strcmp(argv[i], "--sweep") == 0) {
+      sweeping = true;
+    } else if (strcmp(argv[i], "--tails") == 0) {
+      tailing = true;
+    } else if (strcmp(argv[i], "--bandwidth") == 0) {
+      measuring_bandwidth = true;
+    } else if (strcmp(argv[i], "--threads") == 0) {
+      threading = true;
+    } else if (strcmp(argv[i], "--json") == 0) {
+      json = true;
+    } else if (strcmp(argv[i], "--max-length") == 0 && i + 1 < argc) {
+      max_length = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--align-step") == 0 && i + 1 < argc) {
+      align_step = atoi(argv[++i]);
+    } else {
+      usage();
+    }
+  }
+  if (max_length < 1 || align_step < 1 || runs < 1) usage();
+  find_kernels();
   set_up();
-  test("naive", test_naive, 1);
-  test("pure_mycroft4", test_pure_mycroft4, 1);
-  test("mycroft4", test_mycroft4, 1);
-  test("mycroft", test_mycroft, 1);
-  test("pure_mycroft", test_pure_mycroft, 1);
-  test("pure_sse2", test_pure_sse2, 1);
-  test("sse2", test_sse2, 1);
-  test("sse2_and_mycroft4", test_sse2_and_mycroft4, 1);
-  test("twobyte", test_twobyte, 2);
-  test("mycroft2", test_mycroft2, 2);
-  test("pure_mycroft2", test_pure_mycroft2, 2);
-  test("twosse2", test_twosse2, 2);
-  test("twobsse2", test_twobsse2, 2);
-  test("pure_twobsse2", test_pure_twobsse2, 2);
-  time(test_naive, "naive");
-  time(test_pure_mycroft4, "pure_mycroft4");
-  time(test_mycroft4, "mycroft4");
-  time(test_mycroft, "mycroft");
-  time(test_pure_mycroft, "pure_mycroft");
+  if (sweeping) {
+    sweep(json, max_length, align_step);
+    return 0;
+  }
+  if (tailing) {
+    use_needle('*', '#');
+    tails();
+    return 0;
+  }
+  if (measuring_bandwidth) {
+    bandwidth();
+    return 0;
+  }
+  if (threading) {
+    use_needle('*', '#');
+    scaling();
+    return 0;
+  }
+  for (auto& k : fixed_kernels) test(k.name, k.fn, k.bytes);
+  for (auto& k : fixed_kernels) {
+    if (k.info->over_read == EXACT) test_exact(k.name, k.fn, k.bytes);
+  }
+  bool avx2 = __builtin_cpu_supports("avx2");
+  use_needle('_', '_');
+  test("double_underscore", search_for_double_underscore, 2);
+  if (avx2) test("double_underscore_avx2", search_for_double_underscore_avx2, 2);
+
+  // Sets with bytes with the top bit set, nulls, many high nibbles, and half
+  // of all the bytes.  None of them contain the 'a' that test() fills with.
+  bool ssse3 = __builtin_cpu_supports("ssse3");
+  char halves[128];
+  for (int i = 0; i < 128; i++) halves[i] = '*' + 2 * i;
+  char columns[16];
+  for (int i = 0; i < 16; i++) columns[i] = (i << 4) | 5;
+  static const struct {
+    const char* bytes;
+    int count;
+  } sets[] = {
+    {"*/\"\\\n", 5}, {"\xaa#\xff\0", 4}, {"*#/\"\\\n{}[]();<>|", 16},
+    {columns, 16}, {halves, 128}
+  };
+  for (auto& set : sets) {
+    use_set(set.bytes, set.count);
+    char name[40];
+    snprintf(name, sizeof(name), "set%d chained", set.count);
+    test(name, chained_pure_sse2, 1);
+    if (ssse3) {
+      snprintf(name, sizeof(name), "set%d pure_ssse3", set.count);
+      test(name, with_set<search_set_pure_ssse3>, 1);
+    }
+    if (avx2) {
+      snprintf(name, sizeof(name), "set%d pure_avx2", set.count);
+      test(name, with_set<search_set_pure_avx2>, 1);
+    }
+  }
+  use_set(0, 0);
+  test_substring("substring_sse2", search_substring_pure_sse2);
+  if (avx2) test_substring("substring_avx2", search_substring_pure_avx2);
+
+  // Searching a stream that arrives in pieces.
+  static const char all_pairs[][2] = {{'*', '#'}, {'_', '_'}, {'\xaa', '\0'}};
+  for (auto& pair : all_pairs) {
+    use_needle(pair[0], pair[1]);
+    test_stream("stream_twobsse2", stream_pure_twobsse2);
+    if (avx2) test_stream("stream_twobavx2", stream_pure_twobavx2);
+  }
+
+  // Finding and counting every match, for a few needles.
+  bool popcnt = __builtin_cpu_supports("popcnt");
+  for (auto& pair : all_pairs) {
+    use_needle(pair[0], pair[1]);
+    if (popcnt) {
+      test_find_all("find_all_sse2", all_with_needle<find_all_pure_sse2>,
+                    with_needle<count_pure_sse2>, 1);
+      test_find_all("find_all_twobsse2", all_with_needle2<find_all_pure_twobsse2>,
+                    with_needle2<count_pure_twobsse2>, 2);
+    }
+    if (avx2) {
+      test_find_all("find_all_avx2", all_with_needle<find_all_pure_avx2>,
+                    with_needle<count_pure_avx2>, 1);
+      test_find_all("find_all_twobavx2", all_with_needle2<find_all_pure_twobavx2>,
+                    with_needle2<count_pure_twobavx2>, 2);
+    }
+  }
+  // strchr, strstr and the sentinel kernels, which need strings that end
+  // with a null byte.
+  use_needle('*', '#');
+  for (auto& k : terminated_kernels) test_terminated(k.name, k.fn, k.bytes);
+  for (auto& k : padded_kernels) test_padded(k.name, k.fn, k.bytes);
+
+  // Searching a big buffer on several threads.
+  for (auto& pair : all_pairs) {
+    use_needle(pair[0], pair[1]);
+    test_parallel();
+  }
+  use_needle('*', '#');
+  for (auto& k : fixed_kernels) time(k.fn, k.name);
+
+  // strchr and strstr for comparison, and the sentinel kernels, which don't
+  // check the length, against pure_sse2 and pure_twobsse2 above.  The other
+  // library routines are timed with the runtime needle kernels below.
+  for (auto& k : terminated_kernels) time(k.fn, k.name);
+
+  // The padded kernels, which need no alignment handling, against
+  // pure_sse2 and pure_twobsse2 above.  The inputs have 64 bytes of padding.
+  for (auto& k : padded_kernels) time(k.fn, k.name);
+
+  // The same kernels with the match at an unpredictable distance.
+  for (auto& k : fixed_kernels) time_distances(k.fn, k.name);
+  use_needle('_', '_');
+  time(search_for_double_underscore, "double_underscore");
+  if (avx2) time(search_for_double_underscore_avx2, "double_underscore_avx2");
+
+  // What the dispatch in search_byte and search_pair costs, compared with
+  // calling the routine it picks directly, and with the constant version.
+  use_needle('*', '#');
   time(test_pure_sse2, "pure_sse2");
-  time(test_sse2, "sse2");
-  time(test_sse2_and_mycroft4, "sse2_and_mycroft4");
-  time(test_twobyte, "twobyte");
-  time(test_mycroft2, "mycroft2");
-  time(test_pure_mycroft2, "pure_mycroft2");
-  time(test_twosse2, "twosse2");
-  time(test_twobsse2, "twobsse2");
+  time(with_needle<search_pure_sse2>, "needle pure_sse2");
+  if (avx2) time(with_needle<search_pure_avx2>, "needle pure_avx2");
+  time(with_needle<search_byte>, "search_byte");
   time(test_pure_twobsse2, "pure_twobsse2");
+  time(with_needle2<search_pure_twobsse2>, "needle pure_twobsse2");
+  if (avx2) time(with_needle2<search_pure_twobavx2>, "needle pure_twobavx2");
+  time(with_needle2<search_pair>, "search_pair");
+
+  // The inline kernels against calling them.
+  time_inline();
+
+  // Searching for any byte of a set, with the nibble lookup and by searching
+  // for each byte in turn.
+  static const char lexer[] = "*#/\"\\\n{}[]();<>|";
+  for (int count = 2; count <= 16; count *= 2) {
+    use_set(lexer, count);
+    char name[40];
+    snprintf(name, sizeof(name), "set%d chained", count);
+    time(chained_pure_sse2, name);
+    if (ssse3) {
+      snprintf(name, sizeof(name), "set%d pure_ssse3", count);
+      time(with_set<search_set_pure_ssse3>, name);
+    }
+    if (avx2) {
+      snprintf(name, sizeof(name), "set%d pure_avx2", count);
+      time(with_set<search_set_pure_avx2>, name);
+    }
+  }
+  use_set(0, 0);
+
+  // Substring search against glibc and the standard library.
+  time_substring(avx2);
+
+  // Finding every match against restarting the search.
+  use_needle('*', '#');
+  if (popcnt) time_find_all(avx2);
+
+  // Searching a big buffer on one thread and on several.
+  time_parallel();
+
+  // The same kernels with the needle given at runtime.  Test them with bytes
+  // that need the top bit, nulls, and doubled bytes, then time them against
+  // the constant versions above.
+  static const char pairs[][2] = {
+    {'*', '#'}, {'*' - 128, '#' - 128}, {'_', '_'}, {'\0', '\xff'},
+    {'\xff', '\0'}, {'\x7f', '\x80'}, {'\n', '\r'}, {'/', '*'}
+  };
+  int pair_count = sizeof(pairs) / sizeof(pairs[0]);
+  for (int p = 0; p < pair_count + 2; p++) {
+    bool timing = p >= pair_count;
+    char first = pairs[timing ? p - pair_count : p][0];
+    char second = pairs[timing ? p - pair_count : p][1];
+    use_needle(first, second);
+    for (auto& k : needle_kernels) run(k, timing);
+    for (auto& k : baseline_kernels) run(k, timing);
+    use_needle(first, first);
+    run({"pure_doublesse2", with_needle<search_pure_doublesse2>, 2}, timing);
+  }
+
+  // The templates for needles known at compile time, for a few needles.
+  // For "*#" they should match the hand-written versions.
+  for (int timing = 0; timing < 2; timing++) {
+    constant_kernels<'*', '#'>(timing);
+    constant_kernels<'*' - 128, '#' - 128>(timing);
+    constant_kernels<'/', '*'>(timing);
+    constant_kernels<'_', '_'>(timing);
+  }
+  use_needle('*', '#');
 }
@@ -1,6 +1,18 @@
 // Copyright 2018 Erik Corry.  See the LICENSE file, the BSD 2-clause
 // license.
 
+#ifndef SEARCH_H_
+#define SEARCH_H_
+
+#include <stdint.h>
+
+#include <emmintrin.h>
+#include <immintrin.h>
+
+typedef __m128i uint128_t;
+typedef __m256i uint256_t;
+typedef __m512i uint512_t;
+
 int test_naive(const char* s, int len);
 int test_pure_mycroft4(const char* s, int len);
 int test_mycroft4(const char* s, int len);
@@ -15,3 +27,245 @@ int test_sse2_and_mycroft4(const char* s, int len);
 int test_twosse2(const char* s, int len);
 int test_twobsse2(const char* s, int len);
 int test_pure_twobsse2(const char* s, int len);
+// Start with one unaligned load, for short strings.  See search2.cc.
+int test_small_sse2(const char* s, int len);
+int test_small_twobsse2(const char* s, int len);
+// Only for strings with 64 readable bytes either side.  See padded.cc.
+int test_padded_sse2(const char* s, int len);
+int test_padded_twobsse2(const char* s, int len);
+// Never read outside the string.  See exact.cc.
+int test_exact_sse2(const char* s, int len);
+int test_exact_twobsse2(const char* s, int len);
+int search_for_double_underscore(const char* s, int len);
+
+// AVX2 versions, which must only be called if the CPU has AVX2.
+int test_pure_avx2(const char* s, int len);
+int test_pure_twobavx2(const char* s, int len);
+int test_small_avx2(const char* s, int len);
+int test_padded_avx2(const char* s, int len);
+int test_padded_twobavx2(const char* s, int len);
+int test_exact_avx2(const char* s, int len);
+int test_exact_twobavx2(const char* s, int len);
+int search_for_double_underscore_avx2(const char* s, int len);
+
+// AVX-512 versions, which must only be called if the CPU has AVX-512BW.
+int test_exact_avx512(const char* s, int len);
+int test_exact_twobavx512(const char* s, int len);
+
+// A single byte to search for, broadcast once into the word and vector
+// patterns that the kernels need.  Prepare it once and reuse it for many
+// searches.
+struct Needle {
+  explicit Needle(char c);
+  uint128_t pattern;
+  uint64_t mask64;
+  uint32_t mask32;
+  char c;
+};
+
+// A two-byte sequence to search for, prepared in the same way.
+struct Needle2 {
+  Needle2(char first, char second);
+  uint128_t first_pattern;
+  uint128_t second_pattern;
+  uint64_t first_mask64;
+  uint64_t second_mask64;
+  char first;
+  char second;
+};
+
+// The same kernels as the test_ routines, but searching for a byte or byte
+// pair given at runtime.  The registered ones are never inlined, not even
+// into the direct functions that their own files make for the harness (see
+// KernelInfo), so that every way of timing them makes the same call.
+__attribute__((noinline)) int search_naive(const Needle& n, const char* s, int len);
+__attribute__((noinline)) int search_pure_mycroft4(const Needle& n, const char* s, int len);
+__attribute__((noinline)) int search_mycroft4(const Needle& n, const char* s, int len);
+__attribute__((noinline)) int search_mycroft(const Needle& n, const char* s, int len);
+__attribute__((noinline)) int search_pure_mycroft(const Needle& n, const char* s, int len);
+__attribute__((noinline)) int search_pure_sse2(const Needle& n, const char* s, int len);
+__attribute__((noinline)) int search_sse2(const Needle& n, const char* s, int len);
+__attribute__((noinline)) int search_sse2_and_mycroft4(const Needle& n, const char* s, int len);
+__attribute__((noinline)) int search_twobyte(const Needle2& n, const char* s, int len);
+__attribute__((noinline)) int search_mycroft2(const Needle2& n, const char* s, int len);
+__attribute__((noinline)) int search_pure_mycroft2(const Needle2& n, const char* s, int len);
+__attribute__((noinline)) int search_twosse2(const Needle2& n, const char* s, int len);
+__attribute__((noinline)) int search_twobsse2(const Needle2& n, const char* s, int len);
+__attribute__((noinline)) int search_pure_twobsse2(const Needle2& n, const char* s, int len);
+// Searches for two consecutive copies of the needle byte, like
+// search_for_double_underscore.
+int search_pure_doublesse2(const Needle& n, const char* s, int len);
+// AVX2 versions, which must only be called if the CPU has AVX2.
+__attribute__((noinline)) int search_pure_avx2(const Needle& n, const char* s, int len);
+__attribute__((noinline)) int search_pure_twobavx2(const Needle2& n, const char* s, int len);
+
+// A set of bytes to search for, for example the bytes that end a token in a
+// lexer.  Any number of bytes can be in the set.
+struct ByteSet {
+  ByteSet(const char* bytes, int count);
+  uint128_t low_table;   // PSHUFB tables, see set.cc.
+  uint128_t high_table;
+  uint64_t bitmap[4];    // One bit per byte value.
+};
+
+// Find the first byte in s that is in the set, or return -127.  The vector
+// versions must only be called if the CPU has SSSE3 or AVX2.
+int search_set_naive(const ByteSet& set, const char* s, int len);
+int search_set_pure_ssse3(const ByteSet& set, const char* s, int len);
+int search_set_pure_avx2(const ByteSet& set, const char* s, int len);
+
+// A needle of 1 to 64 bytes to search for, like the needle for memmem.  The
+// bytes are not copied, so they must outlive the Substring.
+struct Substring {
+  Substring(const char* needle, int length);
+  uint128_t first_pattern;
+  uint128_t last_pattern;
+  const char* needle;
+  int length;
+};
+
+// Find the first occurrence of the needle in s, or return -127.  The AVX2
+// version must only be called if the CPU has AVX2.
+int search_substring_naive(const Substring& n, const char* s, int len);
+int search_substring_pure_sse2(const Substring& n, const char* s, int len);
+int search_substring_pure_avx2(const Substring& n, const char* s, int len);
+
+// Find every match instead of the first, writing at most max positions, in
+// order, and returning how many were written.  The count_ routines return
+// the number of matches, and must only be called if the CPU has POPCNT.
+// Two-byte matches may overlap.  The AVX2 versions must only be called if
+// the CPU has AVX2.
+int find_all_pure_sse2(const Needle& n, const char* s, int len, int* positions, int max);
+int find_all_pure_twobsse2(const Needle2& n, const char* s, int len, int* positions, int max);
+int find_all_pure_avx2(const Needle& n, const char* s, int len, int* positions, int max);
+int find_all_pure_twobavx2(const Needle2& n, const char* s, int len, int* positions, int max);
+int count_pure_sse2(const Needle& n, const char* s, int len);
+int count_pure_twobsse2(const Needle2& n, const char* s, int len);
+int count_pure_avx2(const Needle& n, const char* s, int len);
+int count_pure_twobavx2(const Needle2& n, const char* s, int len);
+
+// What a search for a two-byte needle carries from one buffer to the next
+// when the data comes in pieces.
+struct StreamState {
+  StreamState() : carry(0) {}
+  int carry;  // 1 if the previous buffer ended with an unmatched first byte.
+};
+
+// Search the next buffer of a stream for a two-byte needle.  Returns the
+// position of the first match, which is -1 if the match started at the end
+// of the previous buffer, or -127.  After a match, resume the stream at one
+// after the position, with the same state.  The AVX2 version must only be
+// called if the CPU has AVX2.
+int stream_pure_twobsse2(const Needle2& n, StreamState* state, const char* s, int len);
+int stream_pure_twobavx2(const Needle2& n, StreamState* state, const char* s, int len);
+
+// Search text that ends with a null byte for "*" or "*#", with no length.
+// Returns a pointer to the first match, or to the null byte if it comes
+// first.  See sentinel.cc.
+const char* sentinel_pure_sse2(const char* s);
+const char* sentinel_pure_twobsse2(const char* s);
+
+// Search for a byte or a byte pair with the fastest of the routines above
+// that the CPU supports.  The choice is made once, when the program is
+// loaded.
+int search_byte(const Needle& n, const char* s, int len);
+int search_pair(const Needle2& n, const char* s, int len);
+
+// Threads that search a big buffer together, see parallel.cc.  The buffer is
+// split into chunks of chunk_size bytes, rounded down to whole cache lines.
+// The thread that calls search_byte or search_pair is one of the threads.
+// Returns the position of the first match, or -127.  A pool must only be
+// used by one thread at a time.
+struct PoolState;
+class SearchPool {
+ public:
+  explicit SearchPool(int threads, int chunk_size = 1 << 16);
+  ~SearchPool();
+  long long search_byte(const Needle& n, const char* s, long long len);
+  long long search_pair(const Needle2& n, const char* s, long long len);
+
+ private:
+  long long run(const Needle* n, const Needle2* n2, const char* s, long long len);
+  PoolState* state_;
+};
+
+// CPU features that a kernel needs, apart from SSE2, which every x86-64 CPU
+// has.
+enum Isa {
+  ISA_SSE2 = 0,
+  ISA_SSSE3 = 1 << 0,
+  ISA_POPCNT = 1 << 1,
+  ISA_AVX2 = 1 << 2,
+  ISA_AVX512BW = 1 << 3,
+};
+
+// How far outside the string a kernel may read.
+enum OverRead {
+  EXACT,    // Only the bytes of the string.
+  ALIGNED,  // Bytes either side of it, but only in aligned blocks of the
+            // size of its loads that also hold bytes of the string, so it
+            // can't fault.
+  PAGE,     // Aligned blocks like ALIGNED, and bytes after it in the same
+            // page.
+  PADDED,   // Any of the 64 bytes either side of it, which the caller must
+            // make readable.
+};
+
+// Tags that name a search_ routine for a Needle or a Needle2 at compile
+// time, for registering it, so that the registry can make a function that
+// calls it directly.
+template<int (*fn)(const Needle&, const char*, int)> struct ByteSearch {};
+template<int (*fn)(const Needle2&, const char*, int)> struct PairSearch {};
+
+// The kernels that find the first match of a byte or a pair register
+// themselves with a KernelInfo, so that the harness finds them all.  Each
+// has one of the three kinds of function: a test_ routine, which searches
+// for '*' or "*#", or a search_ routine for a Needle or a Needle2.  A
+// search_ routine is registered with its tag, and also gets a direct
+// function, which calls it for KernelInfo::needle or KernelInfo::needle2
+// with no call through a pointer, for timing.  They are kept in a list, in
+// the order they are registered.
+struct KernelInfo {
+  KernelInfo(const char* name, int (*fixed)(const char*, int), int bytes, int isa, OverRead over_read);
+  template<int (*fn)(const Needle&, const char*, int)>
+  KernelInfo(const char* name, ByteSearch<fn>, int isa, OverRead over_read)
+      : KernelInfo(name, fn, 0, call_byte<fn>, 1, isa, over_read) {}
+  template<int (*fn)(const Needle2&, const char*, int)>
+  KernelInfo(const char* name, PairSearch<fn>, int isa, OverRead over_read)
+      : KernelInfo(name, 0, fn, call_pair<fn>, 2, isa, over_read) {}
+  bool supported() const;  // Whether the CPU can run it.
+  const char* name;
+  int (*fixed)(const char* s, int len);
+  int (*byte)(const Needle& n, const char* s, int len);
+  int (*pair)(const Needle2& n, const char* s, int len);
+  int (*direct)(const char* s, int len);
+  int bytes;  // The width of the needle, 1 or 2.
+  int isa;
+  OverRead over_read;
+  const KernelInfo* next;
+  static const KernelInfo* first;
+  // The needles that the direct functions search for.
+  static Needle needle;
+  static Needle2 needle2;
+
+ private:
+  KernelInfo(const char* name, int (*byte)(const Needle&, const char*, int),
+             int (*pair)(const Needle2&, const char*, int),
+             int (*direct)(const char*, int), int bytes, int isa, OverRead over_read);
+  template<int (*fn)(const Needle&, const char*, int)>
+  static int call_byte(const char* s, int len) {
+    return fn(needle, s, len);
+  }
+  template<int (*fn)(const Needle2&, const char*, int)>
+  static int call_pair(const char* s, int len) {
+    return fn(needle2, s, len);
+  }
+};
+
+// Templates for needles that are known at compile time.
+#include "constant.h"
+
+// Inline versions of the fastest search_ routines.
+#include "inline.h"
+
+#endif  // SEARCH_H_
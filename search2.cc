@@ -12,8 +12,6 @@
 #include <stdio.h>
 #include <string.h>
 
-#include <emmintrin.h>
-
 #include "search.h"
 
 // Search for a single asterisk by stepping through the string.
@@ -37,8 +35,6 @@ int test_twobyte(const char* s, int len) {
   return -127;
 }
 
-typedef __m128i uint128_t;
-
 // Search for "*" using only aligned SSE2 128 bit loads. This may load data
 // either side of the string, but can never cause a fault because the loads are
 // in 128 bit sections also covered by the string.
@@ -249,6 +245,67 @@ int test_pure_twobsse2(const char* s, int len) {
   return -127;
 }
 
+// Search for "*" with one unaligned SSE2 load of the first 16 bytes, if it
+// can't cross into the next page, so a short string, or a match near the
+// start, is found with no loop.  The rest of the string, if any, is searched
+// with aligned loads from the first aligned block after those 16 bytes.
+// Like the aligned loads, the first load may read bytes after the end of
+// the string, but only in the same page as its first byte.  If it would
+// cross a page boundary, use test_pure_sse2, which never does.  An empty
+// string has no first byte, and s may be in an unmapped page.
+int test_small_sse2(const char* s, int len) {
+  if (len <= 0) return -127;
+  if (((uintptr_t)s & 4095) > 4096 - 16) return test_pure_sse2(s, len);
+  const uint128_t mask = _mm_set1_epi8('*');
+  uint128_t raw = _mm_loadu_si128((const uint128_t*)s);
+  int bits = _mm_movemask_epi8(_mm_cmpeq_epi8(raw, mask));
+  // Only the bits for the bytes of the string.
+  if (len < 16) bits &= (1 << len) - 1;
+  if (bits) return __builtin_ctz(bits);
+  for (int i = ((uintptr_t)(s + 16) & ~(uintptr_t)15) - (uintptr_t)s; i < len; i += 16) {
+    raw = *(uint128_t*)(s + i);
+    bits = _mm_movemask_epi8(_mm_cmpeq_epi8(raw, mask));
+    if (bits) {
+      int answer = i + __builtin_ctz(bits);
+      if (answer >= len) return -127;
+      return answer;
+    }
+  }
+  return -127;
+}
+
+// Search for "*#" like test_small_sse2.  The aligned loop starts with the
+// bit for the star just before its first block, which the first load has
+// already seen, so a match that straddles the two is found.
+int test_small_twobsse2(const char* s, int len) {
+  if (len <= 0) return -127;
+  if (((uintptr_t)s & 4095) > 4096 - 16) return test_pure_twobsse2(s, len);
+  const uint128_t star_pattern = _mm_set1_epi8('*');
+  const uint128_t hash_pattern = _mm_set1_epi8('#');
+  uint128_t raw = _mm_loadu_si128((const uint128_t*)s);
+  int stars = _mm_movemask_epi8(_mm_cmpeq_epi8(raw, star_pattern));
+  int hashes = _mm_movemask_epi8(_mm_cmpeq_epi8(raw, hash_pattern));
+  // A match at n has its hash at n + 1, which must be in the string.
+  if (len < 16) hashes &= (1 << len) - 1;
+  int combined = (stars << 1) & hashes;
+  if (combined) return __builtin_ctz(combined) - 1;
+  int i = ((uintptr_t)(s + 16) & ~(uintptr_t)15) - (uintptr_t)s;
+  stars = (stars >> (i - 1)) & 1;
+  for ( ; i < len; i += 16) {
+    raw = *(uint128_t*)(s + i);
+    stars += _mm_movemask_epi8(_mm_cmpeq_epi8(raw, star_pattern)) << 1;
+    hashes = _mm_movemask_epi8(_mm_cmpeq_epi8(raw, hash_pattern));
+    combined = hashes & stars;
+    if (combined) {
+      int result = i + __builtin_ctz(combined) - 1;
+      if (result >= len - 1) return -127;
+      return result;
+    }
+    stars >>= 16;
+  }
+  return -127;
+}
+
 // Search for "__" (double underscore) using only aligned SSE2 128 bit loads.
 // This may load data either side of the string, but can never cause a fault
 // because the loads are in 128 bit sections also covered by the string.
@@ -324,17 +381,21 @@ int test_pure_mycroft4(const char* s, int len) {
   int last_bits = (uintptr_t)s & 3;
   int i = -last_bits;
   const uint32_t mask = 0x2a2a2a2aul;
-  uint32_t highs = 0x80808080ul << (last_bits << 3);
+  // Bytes before the string are forced non-zero rather than just masked out
+  // of the result, otherwise the borrow from a match there can flag the
+  // byte after it.
+  uint32_t before = ~(~(uint32_t)0 << (last_bits << 3));
+  const uint32_t highs = 0x80808080ul;
   const uint32_t ones = 0x01010101ul;
   for ( ; i < len; i += 4) {
-    uint32_t raw = *(uint32_t*)(s + i) ^ mask;
+    uint32_t raw = (*(uint32_t*)(s + i) ^ mask) | before;
     raw = (raw - ones) & (~raw) & highs;
     if (raw) {
       int answer = i + (__builtin_ffs(raw) >> 3) - 1;
       if (answer >= len) return -127;
       return answer;
     }
-    highs = 0x80808080ul;
+    before = 0;
   }
   return -127;
 }
@@ -381,17 +442,21 @@ int test_pure_mycroft(const char* s, int len) {
   int last_bits = (uintptr_t)s & 7;
   int i = -last_bits;
   const uint64_t mask = 0x2a2a2a2a2a2a2a2aul;
-  uint64_t highs = 0x8080808080808080ul << (last_bits << 3);
+  // Bytes before the string are forced non-zero rather than just masked out
+  // of the result, otherwise the borrow from a match there can flag the
+  // byte after it.
+  uint64_t before = ~(~(uint64_t)0 << (last_bits << 3));
+  const uint64_t highs = 0x8080808080808080ul;
   const uint64_t ones = 0x0101010101010101ul;
   for ( ; i < len; i += 8) {
-    uint64_t raw = *(uint64_t*)(s + i) ^ mask;
+    uint64_t raw = (*(uint64_t*)(s + i) ^ mask) | before;
     raw = (raw - ones) & (~raw) & highs;
     if (raw) {
       int answer = i + (__builtin_ffsll(raw) >> 3) - 1;
       if (answer >= len) return -127;
       return answer;
     }
-    highs = 0x8080808080808080ul;
+    before = 0;
   }
   return -127;
 }
@@ -416,12 +481,13 @@ int test_mycroft2(const char* s, int len) {
   const uint64_t mask_star = 0x2a2a2a2a2a2a2a2aul;
   const uint64_t mask_hash = 0x2323232323232323ul;
   const uint64_t highs = 0x8080808080808080ul;
-  const uint64_t ones = 0x0101010101010101ul;
+  const uint64_t lows = 0x7f7f7f7f7f7f7f7ful;
   for ( ; i < len; i += 8) {
     uint64_t raw = *(uint64_t*)(s + i - 1) ^ mask_star;
     uint64_t raw2 = *(uint64_t*)(s + i) ^ mask_hash;
-    raw = ((raw - ones) & (~raw));
-    raw2 = ((raw2 - ones) & (~raw2));
+    // See test_pure_mycroft2 for why this does not use (x - ones) & ~x.
+    raw = ~(((raw & lows) + lows) | raw);
+    raw2 = ~(((raw2 & lows) + lows) | raw2);
     uint64_t combined = raw & raw2 & highs;
     if (combined) {
       int result = (i - 1) + (__builtin_ffsll(combined) >> 3) - 1;
@@ -445,14 +511,17 @@ int test_pure_mycroft2(const char* s, int len) {
   const uint64_t mask_star = 0x2a2a2a2a2a2a2a2aul;
   const uint64_t mask_hash = 0x2323232323232323ul;
   uint64_t highs = 0x8080808080808080ul << (last_bits << 3);
-  const uint64_t ones = 0x0101010101010101ul;
+  const uint64_t lows = 0x7f7f7f7f7f7f7f7ful;
   uint64_t stars_low = 0;
   for ( ; i < len; i += 8) {
     uint64_t raw = *(uint64_t*)(s + i);
     uint64_t new_stars = raw ^ mask_star;
     uint64_t hashes = raw ^ mask_hash;
-    new_stars = ((new_stars - ones) & (~new_stars)) & highs;
-    hashes = ((hashes - ones) & (~hashes));
+    // Unlike in the single byte versions, a false positive just after a
+    // real match is not harmless here, so use the form of the test that
+    // does not borrow between bytes.
+    new_stars = ~(((new_stars & lows) + lows) | new_stars) & highs;
+    hashes = ~(((hashes & lows) + lows) | hashes);
     stars_low += new_stars << 8;
     uint64_t combined = stars_low & hashes;
     if (combined) {
@@ -480,3 +549,24 @@ int test_pure_mycroft2(const char* s, int len) {
 // (unsigned char)(val >> 7)
 // Doing this last step earlier makes it more parallel if there are multiple independent shifters.
 // But it's still too slow.
+
+// The test_ routines, for the harness.  search_for_double_underscore looks
+// for a different needle, so it is not registered.
+static KernelInfo kernels[] = {
+  {"naive", test_naive, 1, ISA_SSE2, EXACT},
+  {"pure_mycroft4", test_pure_mycroft4, 1, ISA_SSE2, ALIGNED},
+  {"mycroft4", test_mycroft4, 1, ISA_SSE2, ALIGNED},
+  {"mycroft", test_mycroft, 1, ISA_SSE2, ALIGNED},
+  {"pure_mycroft", test_pure_mycroft, 1, ISA_SSE2, ALIGNED},
+  {"pure_sse2", test_pure_sse2, 1, ISA_SSE2, ALIGNED},
+  {"sse2", test_sse2, 1, ISA_SSE2, ALIGNED},
+  {"sse2_and_mycroft4", test_sse2_and_mycroft4, 1, ISA_SSE2, ALIGNED},
+  {"twobyte", test_twobyte, 2, ISA_SSE2, EXACT},
+  {"mycroft2", test_mycroft2, 2, ISA_SSE2, ALIGNED},
+  {"pure_mycroft2", test_pure_mycroft2, 2, ISA_SSE2, ALIGNED},
+  {"twosse2", test_twosse2, 2, ISA_SSE2, ALIGNED},
+  {"twobsse2", test_twobsse2, 2, ISA_SSE2, ALIGNED},
+  {"pure_twobsse2", test_pure_twobsse2, 2, ISA_SSE2, ALIGNED},
+  {"small_sse2", test_small_sse2, 1, ISA_SSE2, PAGE},
+  {"small_twobsse2", test_small_twobsse2, 2, ISA_SSE2, PAGE},
+};
@@ -0,0 +1,53 @@
+// Copyright 2018 Erik Corry.  See the LICENSE file, the BSD 2-clause
+// license.
+
+// Searching text that ends with a null byte, like the buffers in Clang's
+// lexer, instead of text with a length.  The null byte is searched for at
+// the same time as the needle, so there is no length to compare with the
+// position of each block or of the match, and nothing needs to be known
+// about the text before the search starts.
+
+#include <stdint.h>
+
+#include "search.h"
+
+// See test_pure_sse2.  The null byte is a second pattern, and whichever of
+// the two comes first ends the search.
+const char* sentinel_pure_sse2(const char* s) {
+  int last_bits = (uintptr_t)s & 15;
+  int alignment_mask = 0xffff << last_bits;
+  const uint128_t mask = _mm_set1_epi8('*');
+  const uint128_t zero = _mm_setzero_si128();
+  for (const char* block = s - last_bits; ; block += 16) {
+    uint128_t raw = *(uint128_t*)block;
+    uint128_t either = _mm_or_si128(_mm_cmpeq_epi8(raw, mask), _mm_cmpeq_epi8(raw, zero));
+    int bits = _mm_movemask_epi8(either) & alignment_mask;
+    if (bits) return block + __builtin_ctz(bits);
+    alignment_mask = 0xffff;
+  }
+}
+
+// See test_pure_twobsse2.  A null byte is found at its own position, while
+// a match is found at the position of its hash, so the lowest bit is
+// whichever comes first.
+const char* sentinel_pure_twobsse2(const char* s) {
+  int last_bits = (uintptr_t)s & 15;
+  int alignment_mask = 0xffff << last_bits;
+  const uint128_t star_pattern = _mm_set1_epi8('*');
+  const uint128_t hash_pattern = _mm_set1_epi8('#');
+  const uint128_t zero = _mm_setzero_si128();
+  int stars = 0;
+  for (const char* block = s - last_bits; ; block += 16) {
+    uint128_t raw = *(uint128_t*)block;
+    stars += (_mm_movemask_epi8(_mm_cmpeq_epi8(raw, star_pattern)) & alignment_mask) << 1;
+    int hashes = _mm_movemask_epi8(_mm_cmpeq_epi8(raw, hash_pattern));
+    int nulls = _mm_movemask_epi8(_mm_cmpeq_epi8(raw, zero)) & alignment_mask;
+    int combined = (hashes & stars) | nulls;
+    if (combined) {
+      int bit = __builtin_ctz(combined);
+      return nulls & (1 << bit) ? block + bit : block + bit - 1;
+    }
+    stars >>= 16;
+    alignment_mask = 0xffff;
+  }
+}
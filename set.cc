@@ -0,0 +1,113 @@
+// Copyright 2018 Erik Corry.  See the LICENSE file, the BSD 2-clause
+// license.
+
+// Routines that search for the first byte that is in a set of bytes, like
+// strpbrk, but with a length and ignoring null bytes.
+//
+// The vector versions classify 16 or 32 bytes at a time using PSHUFB as a
+// table lookup on the low nibble of each byte.  There is one table for bytes
+// 0x00-0x7f and one for 0x80-0xff: entry n has bit h set if the byte with
+// high nibble h and low nibble n is in the set (h is taken modulo 8).  PSHUFB
+// gives zero for an index with the top bit set, so looking up the raw bytes
+// in one table and the bytes with the top bit flipped in the other, and oring
+// the results, gives the right row for every byte.  A third lookup on the high
+// nibble gives the bit to test in that row.  This is exact for any set, not
+// just sets with few distinct high nibbles.
+
+#include <stdint.h>
+
+#include "search.h"
+
+ByteSet::ByteSet(const char* bytes, int count) {
+  uint8_t low[16] = {0};
+  uint8_t high[16] = {0};
+  for (int i = 0; i < 4; i++) bitmap[i] = 0;
+  for (int i = 0; i < count; i++) {
+    uint8_t b = bytes[i];
+    bitmap[b >> 6] |= 1ull << (b & 63);
+    uint8_t* table = (b & 0x80) ? high : low;
+    table[b & 15] |= 1 << ((b >> 4) & 7);
+  }
+  low_table = _mm_loadu_si128((uint128_t*)low);
+  high_table = _mm_loadu_si128((uint128_t*)high);
+}
+
+// Search for a byte in the set by stepping through the string.
+int search_set_naive(const ByteSet& set, const char* s, int len) {
+  for (int i = 0; i < len; i++) {
+    uint8_t b = s[i];
+    if ((set.bitmap[b >> 6] >> (b & 63)) & 1) {
+      return i;
+    }
+  }
+  return -127;
+}
+
+// Search for a byte in the set using only aligned 128 bit loads, as in
+// test_pure_sse2.  This may load data either side of the string, but can
+// never cause a fault because the loads are in 128 bit sections also covered
+// by the string.
+__attribute__((target("ssse3")))
+int search_set_pure_ssse3(const ByteSet& set, const char* s, int len) {
+  int last_bits = (uintptr_t)s & 15;
+  int alignment_mask = 0xffff << last_bits;
+  const uint128_t low_table = set.low_table;
+  const uint128_t high_table = set.high_table;
+  const uint128_t bit_table = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128,
+                                            1, 2, 4, 8, 16, 32, 64, -128);
+  const uint128_t top_bits = _mm_set1_epi8(-128);
+  const uint128_t nibble = _mm_set1_epi8(15);
+  const uint128_t zero = _mm_setzero_si128();
+  for (int i = -last_bits ; i < len; i += 16) {
+    uint128_t raw = *(uint128_t*)(s + i);
+    // PSHUFB uses the low nibble of each byte as an index, or gives zero if
+    // the top bit is set.
+    uint128_t row = _mm_or_si128(_mm_shuffle_epi8(low_table, raw),
+                                 _mm_shuffle_epi8(high_table, _mm_xor_si128(raw, top_bits)));
+    uint128_t high_nibbles = _mm_and_si128(_mm_srli_epi16(raw, 4), nibble);
+    uint128_t column = _mm_shuffle_epi8(bit_table, high_nibbles);
+    // Bytes that are not in the set compare equal to zero.
+    int misses = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(row, column), zero));
+    int bits = (misses ^ 0xffff) & alignment_mask;
+    if (bits) {
+      int answer = i + __builtin_ffs(bits) - 1;
+      if (answer >= len) return -127;
+      return answer;
+    }
+    alignment_mask = 0xffff;
+  }
+  return -127;
+}
+
+// The same as search_set_pure_ssse3, 32 bytes at a time with AVX2.
+__attribute__((target("avx2")))
+int search_set_pure_avx2(const ByteSet& set, const char* s, int len) {
+  int last_bits = (uintptr_t)s & 31;
+  uint32_t alignment_mask = 0xffffffffu << last_bits;
+  // VPSHUFB looks up each 128 bit lane in its own copy of the table.
+  const uint256_t low_table = _mm256_broadcastsi128_si256(set.low_table);
+  const uint256_t high_table = _mm256_broadcastsi128_si256(set.high_table);
+  const uint256_t bit_table = _mm256_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128,
+                                               1, 2, 4, 8, 16, 32, 64, -128,
+                                               1, 2, 4, 8, 16, 32, 64, -128,
+                                               1, 2, 4, 8, 16, 32, 64, -128);
+  const uint256_t top_bits = _mm256_set1_epi8(-128);
+  const uint256_t nibble = _mm256_set1_epi8(15);
+  const uint256_t zero = _mm256_setzero_si256();
+  for (int i = -last_bits ; i < len; i += 32) {
+    uint256_t raw = *(uint256_t*)(s + i);
+    uint256_t row = _mm256_or_si256(_mm256_shuffle_epi8(low_table, raw),
+                                    _mm256_shuffle_epi8(high_table, _mm256_xor_si256(raw, top_bits)));
+    uint256_t high_nibbles = _mm256_and_si256(_mm256_srli_epi16(raw, 4), nibble);
+    uint256_t column = _mm256_shuffle_epi8(bit_table, high_nibbles);
+    uint32_t misses = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(row, column), zero));
+    uint32_t bits = ~misses & alignment_mask;
+    if (bits) {
+      int answer = i + __builtin_ctz(bits);
+      if (answer >= len) return -127;
+      return answer;
+    }
+    alignment_mask = 0xffffffffu;
+  }
+  return -127;
+}
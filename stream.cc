@@ -0,0 +1,82 @@
+// Copyright 2018 Erik Corry.  See the LICENSE file, the BSD 2-clause
+// license.
+
+// Searching for a two-byte sequence in data that arrives in pieces, for
+// example blocks read from a socket, where the sequence can be split between
+// two blocks.  The two-byte routines already carry a bit from one 16 byte
+// block to the next for a first byte at the end of a block.  These keep that
+// bit in a StreamState between calls, so the search can go on in the next
+// buffer without copying the last byte of the previous one or looking at it
+// again.
+
+#include <stdint.h>
+
+#include "search.h"
+
+// See test_pure_twobsse2.  Returns -1 if the needle starts with the last byte
+// of the previous buffer and ends with the first byte of this one.
+int stream_pure_twobsse2(const Needle2& n, StreamState* state, const char* s, int len) {
+  if (len <= 0) return -127;
+  int last_bits = (uintptr_t)s & 15;
+  int alignment_mask = 0xffff << last_bits;
+  const uint128_t star_pattern = n.first_pattern;
+  const uint128_t hash_pattern = n.second_pattern;
+  // Bit k + 1 of stars is for byte k of the block, so the byte before the
+  // string goes in bit last_bits.
+  int stars = state->carry << last_bits;
+  for (int i = -last_bits ; i < len; i += 16) {
+    uint128_t raw = *(uint128_t*)(s + i);
+    stars += (_mm_movemask_epi8(_mm_cmpeq_epi8(raw, star_pattern)) & alignment_mask) << 1;
+    int hashes = _mm_movemask_epi8(_mm_cmpeq_epi8(raw, hash_pattern));
+    int combined = hashes & stars;
+    if (combined) {
+      int result = i + __builtin_ffs(combined) - 2;
+      if (result < len - 1) {
+        // The first byte of this match has been used up, so if the search
+        // is resumed after it there is nothing to carry.
+        state->carry = 0;
+        return result;
+      }
+    }
+    if (len - i <= 16) {
+      // The last block: remember whether the last byte was a first byte.
+      state->carry = (stars >> (len - i)) & 1;
+      return -127;
+    }
+    stars >>= 16;
+    alignment_mask = 0xffff;
+  }
+  return -127;
+}
+
+// See test_pure_twobavx2 and stream_pure_twobsse2.
+__attribute__((target("avx2")))
+int stream_pure_twobavx2(const Needle2& n, StreamState* state, const char* s, int len) {
+  if (len <= 0) return -127;
+  int last_bits = (uintptr_t)s & 31;
+  uint32_t alignment_mask = 0xffffffffu << last_bits;
+  const uint256_t star_pattern = _mm256_broadcastsi128_si256(n.first_pattern);
+  const uint256_t hash_pattern = _mm256_broadcastsi128_si256(n.second_pattern);
+  uint64_t stars = (uint64_t)state->carry << last_bits;
+  for (int i = -last_bits ; i < len; i += 32) {
+    uint256_t raw = *(uint256_t*)(s + i);
+    uint32_t new_stars = _mm256_movemask_epi8(_mm256_cmpeq_epi8(raw, star_pattern));
+    stars += (uint64_t)(new_stars & alignment_mask) << 1;
+    uint32_t hashes = _mm256_movemask_epi8(_mm256_cmpeq_epi8(raw, hash_pattern));
+    uint32_t combined = hashes & (uint32_t)stars;
+    if (combined) {
+      int result = i + __builtin_ctz(combined) - 1;
+      if (result < len - 1) {
+        state->carry = 0;
+        return result;
+      }
+    }
+    if (len - i <= 32) {
+      state->carry = (stars >> (len - i)) & 1;
+      return -127;
+    }
+    stars >>= 32;
+    alignment_mask = 0xffffffffu;
+  }
+  return -127;
+}
@@ -0,0 +1,99 @@
+// Copyright 2018 Erik Corry.  See the LICENSE file, the BSD 2-clause
+// license.
+
+// Routines that search for a needle of up to 64 bytes, like memmem.
+//
+// The vector versions use the idea from test_pure_twobsse2: find the first
+// and last bytes of the needle with PCMPEQB and PMOVMSKB, and shift the bits
+// for the first byte along so they line up with the bits for the last byte.
+// In test_pure_twobsse2 the shift is one, and the one bit that falls off the
+// top of a block is carried into the next.  Here the shift is the length of
+// the needle minus one, so up to 63 bits are carried, in a 128 bit integer
+// that holds the bits for the current block and the 64 bytes before it.
+// Where both bytes match, the bytes between them are compared with memcmp.
+// That compare never reads outside the string.
+
+#include <stdint.h>
+#include <string.h>
+
+#include "search.h"
+
+Substring::Substring(const char* needle, int length)
+    : needle(needle), length(length) {
+  first_pattern = _mm_set1_epi8(needle[0]);
+  last_pattern = _mm_set1_epi8(needle[length - 1]);
+}
+
+// Search for the needle by comparing at every position.
+int search_substring_naive(const Substring& n, const char* s, int len) {
+  int last = len - n.length;
+  for (int i = 0; i <= last; i++) {
+    if (memcmp(s + i, n.needle, n.length) == 0) {
+      return i;
+    }
+  }
+  return -127;
+}
+
+// Search for the needle using only aligned SSE2 128 bit loads. This may load
+// data either side of the string, but can never cause a fault because the
+// loads are in 128 bit sections also covered by the string.
+int search_substring_pure_sse2(const Substring& n, const char* s, int len) {
+  int last_bits = (uintptr_t)s & 15;
+  int alignment_mask = 0xffff << last_bits;
+  const uint128_t first_pattern = n.first_pattern;
+  const uint128_t last_pattern = n.last_pattern;
+  const int distance = n.length - 1;
+  const char* middle = n.needle + 1;
+  const int middle_length = distance > 1 ? distance - 1 : 0;
+  // Bit 64 + k is set if the needle could start at byte k of the current
+  // block.  The lower bits are for the 64 bytes before the block.
+  unsigned __int128 firsts = 0;
+  for (int i = -last_bits ; i < len; i += 16) {
+    uint128_t raw = *(uint128_t*)(s + i);
+    int new_firsts = _mm_movemask_epi8(_mm_cmpeq_epi8(raw, first_pattern)) & alignment_mask;
+    firsts = (firsts >> 16) | ((unsigned __int128)new_firsts << 64);
+    int lasts = _mm_movemask_epi8(_mm_cmpeq_epi8(raw, last_pattern));
+    // Bit k is set if the needle could end at byte k of the block.
+    int candidates = lasts & (int)(uint64_t)(firsts >> (64 - distance));
+    while (candidates) {
+      int end = i + __builtin_ctz(candidates);
+      if (end >= len) return -127;
+      int start = end - distance;
+      if (memcmp(s + start + 1, middle, middle_length) == 0) return start;
+      candidates &= candidates - 1;
+    }
+    alignment_mask = 0xffff;
+  }
+  return -127;
+}
+
+// The same as search_substring_pure_sse2, 32 bytes at a time with AVX2.
+// Must only be called if the CPU has AVX2.
+__attribute__((target("avx2")))
+int search_substring_pure_avx2(const Substring& n, const char* s, int len) {
+  int last_bits = (uintptr_t)s & 31;
+  uint32_t alignment_mask = 0xffffffffu << last_bits;
+  const uint256_t first_pattern = _mm256_broadcastsi128_si256(n.first_pattern);
+  const uint256_t last_pattern = _mm256_broadcastsi128_si256(n.last_pattern);
+  const int distance = n.length - 1;
+  const char* middle = n.needle + 1;
+  const int middle_length = distance > 1 ? distance - 1 : 0;
+  unsigned __int128 firsts = 0;
+  for (int i = -last_bits ; i < len; i += 32) {
+    uint256_t raw = *(uint256_t*)(s + i);
+    uint32_t new_firsts = _mm256_movemask_epi8(_mm256_cmpeq_epi8(raw, first_pattern)) & alignment_mask;
+    firsts = (firsts >> 32) | ((unsigned __int128)new_firsts << 64);
+    uint32_t lasts = _mm256_movemask_epi8(_mm256_cmpeq_epi8(raw, last_pattern));
+    uint32_t candidates = lasts & (uint32_t)(uint64_t)(firsts >> (64 - distance));
+    while (candidates) {
+      int end = i + __builtin_ctz(candidates);
+      if (end >= len) return -127;
+      int start = end - distance;
+      if (memcmp(s + start + 1, middle, middle_length) == 0) return start;
+      candidates &= candidates - 1;
+    }
+    alignment_mask = 0xffffffffu;
+  }
+  return -127;
+}